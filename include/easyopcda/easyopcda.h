@@ -33,6 +33,7 @@
 #include <iomanip>
 #include <codecvt>
 #include <chrono>
+#include <vector>
 
 
 #define DEBUG_LOG(...) if(easyopcda::logEnabler.logToDefault)spdlog::debug(__VA_ARGS__);if(easyopcda::logEnabler.logToString){easyopcda::logEnabler.logger->debug(__VA_ARGS__);}
@@ -51,6 +52,263 @@ namespace easyopcda {
 
     typedef std::function<void(std::wstring groupName, opcTagResult)> ASyncCallback;
 
+    // same as opcTagResult, but owns a copy of the value: used where results outlive the DCOM callback
+    typedef struct {
+        std::wstring tagName;
+        FILETIME timestamp;
+        ATL::CComVariant value;
+        WORD quality;
+        HRESULT error;
+    } opcTagValue;
+
+    // result of an asynchronous read: error is set when the transaction as a whole failed (e.g. timed out)
+    typedef struct {
+        HRESULT error;
+        std::vector<opcTagValue> values;
+    } opcReadResult;
+
+    // counters of a group, read with OPCGroup::getMetrics
+    typedef struct {
+        uint64_t transactionsIssued;
+        uint64_t transactionsCompleted;
+        uint64_t transactionsCancelled;
+        uint64_t transactionsTimedOut;
+        uint64_t readsRejected;
+        DWORD readsInFlight;
+        DWORD readWindow;
+        double readLatencyMs;
+        DWORD creationRoundTrips; // calls to the server made by the group constructor
+    } opcGroupMetrics;
+
+    // outcome of OPCGroup::shutdown. server calls abandoned at the deadline finish, or fail, in the background
+    typedef struct {
+        bool completed; // every step finished within the deadline
+        double elapsedMs;
+        size_t callsAbandoned; // unadvise, cancel, remove and release calls not finished at the deadline
+        size_t callbacksAbandoned; // callbacks still running at the deadline; the destructor waits for them
+        size_t transactionsAborted; // pending transactions failed with E_ABORT
+    } opcShutdownReport;
+
+    // lifecycle of an OPCGroup. requests are accepted while inactive, active or degraded (a server call failed),
+    // server callbacks until the group is closing. closed: the group does not exist on the server
+    enum class opcGroupState {
+        creating,
+        active,
+        inactive,
+        degraded,
+        reconnecting,
+        closing,
+        closed
+    };
+
+    // how OPCClient spreads groups over its server connections: in turn, or on the connection whose groups
+    // have the fewest items (then the fewest groups)
+    enum class opcGroupPlacement {
+        roundRobin,
+        leastLoaded
+    };
+
+    // delivery priority of a group. the default (value-initialized) priority is normal
+    enum class opcPriority : int {
+        low = -1,
+        normal = 0,
+        high = 1,
+        critical = 2
+    };
+    // levels of opcPriority, numbered from critical (0) to low (3)
+    inline constexpr size_t priorityLevels = 4;
+    inline constexpr size_t priorityLevel(opcPriority priority) { return static_cast<size_t>(2 - static_cast<int>(priority)); }
+
+    // group to be created by OPCClient::addGroups
+    typedef struct {
+        std::wstring name;
+        DWORD updateRate;
+        opcPriority priority;
+    } opcGroupDef;
+
+    // automatic reconnection of OPCClient. the keep-alive calls GetStatus on every server connection; after a
+    // loss, attempts are spaced by a delay doubling from minBackoffMs up to maxBackoffMs
+    typedef struct {
+        DWORD keepAliveMs;
+        DWORD minBackoffMs;
+        DWORD maxBackoffMs;
+        size_t parallelism; // groups restored concurrently
+    } opcReconnectPolicy;
+
+    // outages seen by OPCClient, read with getReconnectStats. an outage lasts from the detected loss until every
+    // group is restored
+    typedef struct {
+        uint64_t outages;
+        uint64_t attempts;
+        double lastOutageMs;
+        double maxOutageMs;
+        double totalOutageMs;
+        bool connected;
+    } opcReconnectStats;
+
+    // failovers of OPCRedundantPair. values are deduplicated by source timestamp across the two servers
+    typedef struct {
+        size_t activeServer; // 0 primary, 1 secondary
+        uint64_t failovers;
+        double lastSwitchMs; // from the detected failure to the standby values replayed
+        uint64_t duplicatesDropped;
+        uint64_t standbyValuesReplayed;
+        uint64_t standbyValuesOverflowed; // oldest standby values dropped because the tag kept too many
+    } opcFailoverStats;
+
+    // upper bounds of the GetStatus latency buckets of opcServerHealth; the last bucket counts slower calls
+    inline constexpr double healthLatencyBucketsMs[] = {1, 2, 5, 10, 20, 50, 100, 200, 500, 1000};
+
+    // server health, read with OPCClient::getServerHealth. fields below reachable come from the last GetStatus
+    typedef struct {
+        bool reachable;
+        OPCSERVERSTATE state;
+        DWORD groupCount;
+        DWORD bandWidth; // percent of the server bandwidth in use, 0xFFFFFFFF when unknown
+        FILETIME startTime;
+        FILETIME currentTime;
+        FILETIME lastUpdateTime;
+        bool throttled;
+        uint64_t polls;
+        uint64_t failures;
+        double lastLatencyMs;
+        double averageLatencyMs;
+        double maxLatencyMs;
+        std::vector<uint64_t> latencyHistogram;
+    } opcServerHealth;
+
+    // health monitor of OPCClient. the client is throttled while the server is unreachable or not running, while
+    // the average GetStatus latency is above latencyThresholdMs, or the bandwidth above bandWidthThreshold (0: unused)
+    typedef struct {
+        DWORD periodMs;
+        double latencyThresholdMs;
+        DWORD bandWidthThreshold;
+    } opcHealthPolicy;
+
+    // called by the health monitor when reachability, server state or throttling change
+    typedef std::function<void(const opcServerHealth &previous, const opcServerHealth &current)> ServerHealthCallback;
+
+    // OPC DA server found by OPCClient::discoverServers, with the specifications it registered for
+    typedef struct {
+        std::wstring host;
+        std::wstring progID;
+        std::wstring userType;
+        CLSID clsid;
+        bool da10;
+        bool da20;
+        bool da30;
+    } opcDiscoveredServer;
+
+    // value delivered by OPCServerManager, identified by server, group and tag
+    typedef std::function<void(const std::wstring &server, const std::wstring &group, const opcTagValue &value)> ManagedCallback;
+
+    // limits of OPCServerManager. every server gets up to threadsPerServer of the maxThreads shared workers; values
+    // arriving while maxQueuedValues wait for delivery are dropped (0: unbounded)
+    typedef struct {
+        size_t threadsPerServer;
+        size_t maxThreads;
+        size_t maxQueuedValues;
+    } opcManagerLimits;
+
+    typedef struct {
+        size_t servers;
+        uint64_t valuesDelivered;
+        uint64_t valuesDropped;
+        size_t valuesQueued;
+        size_t maxValuesQueued;
+    } opcManagerStats;
+
+    // values of one callback of a group, tagged with the integer id OPCClient gave the group
+    typedef struct {
+        uint32_t groupId;
+        opcPriority priority;
+        std::vector<opcTagValue> values;
+        std::vector<OPCHANDLE> clientHandles; // of the values, in the same order
+    } opcGroupBatch;
+
+    // what the delivery channel does when a group has maxQueuedValues waiting (0: no limit) and more arrive:
+    // block the server callback until there is room, drop the oldest batches, drop the new batch, or keep only
+    // the newest value of every item (memory bounded by the item count, maxQueuedValues unused)
+    enum class opcOverflowPolicy {
+        block,
+        dropOldest,
+        dropNewest,
+        coalesce
+    };
+
+    typedef struct {
+        opcOverflowPolicy policy;
+        size_t maxQueuedValues;
+    } opcOverflowOptions;
+
+    typedef struct {
+        size_t valuesQueued;
+        uint64_t valuesDropped;
+        uint64_t valuesCoalesced; // replaced by a newer value of the same item before delivery
+        uint64_t callbacksBlocked;
+        double blockedMs;
+    } opcOverflowStats;
+
+    typedef std::function<void(const opcGroupBatch &batch)> BatchCallback;
+
+    // how the delivery channel shares its threads among the groups with batches waiting: always the highest
+    // priority first, or every group in turn with turns weighted 8:4:2:1 from critical to low, so that low
+    // priorities are not starved
+    enum class opcPriorityPolicy {
+        strict,
+        weighted
+    };
+
+    // threads: size of the delivery pool. batchesPerTurn: batches a group delivers before the other groups get a turn,
+    // times the weight of its priority with the weighted policy
+    typedef struct {
+        size_t threads;
+        size_t batchesPerTurn;
+        opcPriorityPolicy policy;
+    } opcDeliveryOptions;
+
+    // wait of the batches of one priority, from the group callback to the start of their delivery
+    typedef struct {
+        uint64_t batchesDelivered;
+        size_t batchesQueued;
+        double averageWaitMs;
+        double maxWaitMs;
+    } opcPriorityStats;
+
+    typedef struct {
+        uint64_t batchesDelivered;
+        uint64_t valuesDelivered;
+        size_t batchesQueued;
+        size_t maxBatchesQueued;
+        uint64_t steals; // lane turns run by another thread than the one they were queued on
+        std::vector<opcPriorityStats> priorities; // indexed by priorityLevel
+        uint64_t valuesDropped;
+        uint64_t valuesCoalesced;
+    } opcChannelStats;
+
+    // polling statistics of a group, read with OPCClient::getPollStats. periods are measured between the
+    // starts of consecutive reads
+    typedef struct {
+        DWORD periodMs;
+        uint64_t polls;
+        uint64_t skipped; // cycles skipped because the previous read was still running
+        uint64_t throttled; // cycles skipped because the server health monitor throttles the client
+        double averagePeriodMs;
+        double maxPeriodMs;
+        double averageReadMs;
+    } opcPollStats;
+
+    // value to be written to a tag. value is converted to the canonical data type of the item before
+    // the write; quality and timestamp are sent only when specified and supported by the server (IOPCSyncIO2)
+    typedef struct {
+        std::wstring tagName;
+        ATL::CComVariant value;
+        bool qualitySpecified;
+        WORD quality;
+        bool timestampSpecified;
+        FILETIME timestamp;
+    } opcWriteValue;
+
     class logEnablerClass {
     public:
         logEnablerClass() { logToDefault=true;logToString=false;}
@@ -85,6 +343,11 @@ inline std::string wstringToUTF8(const std::wstring& wstr) {
     return string_converter.to_bytes(wstr);
 }
 
+inline std::wstring utf8ToWstring(const std::string& str) {
+    static std::wstring_convert<std::codecvt_utf8<wchar_t>> string_converter;
+    return string_converter.from_bytes(str);
+}
+
 
 std::wstring inline opcQualityToWstring(WORD quality) {
     switch (quality) {
@@ -222,6 +485,13 @@ std::string inline hresultToUTF8(HRESULT hr) {
     }
 }
 
+// errors meaning that the server process or the connection to it is gone, rather than that a call failed
+bool inline isServerUnavailable(HRESULT hr) {
+    return hr == RPC_E_DISCONNECTED || hr == RPC_E_SERVER_DIED || hr == RPC_E_SERVER_DIED_DNE || hr == CO_E_OBJNOTCONNECTED ||
+           hr == HRESULT_FROM_WIN32(RPC_S_SERVER_UNAVAILABLE) || hr == HRESULT_FROM_WIN32(RPC_S_CALL_FAILED) ||
+           hr == HRESULT_FROM_WIN32(RPC_S_CALL_FAILED_DNE);
+}
+
 
 HRESULT inline OPCServerListCreateInstance(COSERVERINFO *serverInfo, COAUTHIDENTITY *authIdent, bool localhost, ATL::CComPtr<IOPCServerList> &iCatInfo) {
     MULTI_QI qiList[1] =
@@ -21,13 +21,26 @@
 
 #include "easyopcda.h"
 #include "opcda.h"
+#include "opcdeliverychannel.h"
+#include "opcdiscoverycache.h"
+#include "opcexecutor.h"
 #include "opcgroup.h"
+#include "opchealthmonitor.h"
+#include "opcpollscheduler.h"
+#include "opctimer.h"
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/ostream_sink.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <future>
 #include <string>
 #include <map>
+#include <mutex>
+#include <set>
+#include <thread>
+#include <vector>
 
 
 class OPCClient
@@ -50,27 +63,182 @@ private:
 
     std::map<std::wstring, CLSID> progIDtoCLSIDMap;
 
+    std::mutex discoveryMutex;
+    OPCDiscoveryCache *discoveryCache;
+
     std::wstring serverProgID;
     CLSID serverCLSID;
 
     CComPtr<IOPCServer> pOPCServer;
 
+    // instances of the server opened by connect; pOPCServer is the first. each group lives on one of them
+    std::vector<CComPtr<IOPCServer>> serverConnections;
+    size_t connectionCount;
+    easyopcda::opcGroupPlacement groupPlacement;
+    size_t nextConnection;
+    std::map<std::wstring, size_t> groupConnections;
+
+    bool openServerConnections();
+    size_t placeGroup(const std::wstring &name);
+
+    // groups may be added and removed from executor threads
+    std::mutex groupsMutex;
     std::map<std::wstring, OPCGroup*> groups;
+    // ids of the groups in groups, for the delivery channel
+    std::atomic<uint32_t> nextGroupId;
+    std::map<uint32_t, std::wstring> groupNames;
+    // overflow policies set with setOverflowPolicy, given to every channel subscribed
+    std::map<uint32_t, easyopcda::opcOverflowOptions> overflowOptions;
+
+    // delivery channel of subscribe, published with atomic_store. the groups hand their batches to deliverBatch
+    std::mutex channelMutex;
+    std::shared_ptr<OPCDeliveryChannel> channel;
+    void deliverBatch(easyopcda::opcGroupBatch &&batch);
+    void attachGroup(OPCGroup *group, easyopcda::opcPriority priority);
+    void forgetGroupId(uint32_t groupId);
+
+    OPCExecutor *executor;
+    OPCExecutor *ownedExecutor;
+    std::once_flag ownedExecutorOnce;
+    // runs addGroups, removeGroups, the group restore and the teardown of the groups, apart from the executor
+    // serving their server calls. created on first use, see setBulkThreads
+    OPCExecutor *bulkExecutor;
+    std::once_flag bulkExecutorOnce;
+    size_t bulkThreads;
+    bool bulkThreadsSet;
+    OPCExecutor *getBulkExecutor(size_t parallelism);
+    // serves the transaction deadlines of every group, created on first use
+    OPCTimer *timer;
+    std::once_flag timerOnce;
+    OPCTimer *getTimer();
 
     easyopcda::ASyncCallback mCallbackFunc;
 
+    OPCPollScheduler *pollScheduler;
+    size_t pollThreads;
+    double pollJitter;
+
+    // the groups are shut down in parallel within one shutdownDeadlineMs, then deleted
+    DWORD shutdownDeadlineMs;
+    void destroyGroups(std::vector<OPCGroup *> &doomed, size_t parallelism);
+
+    std::mutex healthMutex;
+    OPCHealthMonitor *healthMonitor;
+    // set by the health monitor. polling halves its rate while the server is throttled
+    std::atomic<bool> serverThrottled;
+
+    // reconnect supervisor: a thread sending the keep-alive and, once the server is lost, restoring the
+    // connections and every group in place, so that OPCGroup pointers held by the user stay valid
+    std::thread supervisorThread;
+    std::mutex supervisorMutex;
+    std::condition_variable supervisorCv;
+    bool supervisorRunning;
+    bool reconnectRequested;
+    std::string reconnectCause;
+    easyopcda::opcReconnectPolicy reconnectPolicy;
+    easyopcda::opcReconnectStats reconnectStats;
+    std::function<void(const std::string &cause)> connectionLostCallback;
+    // held while groups are restored, so that they cannot be deleted meanwhile. taken before groupsMutex
+    std::mutex recoveryMutex;
+    // groups whose restore failed while the server was available, retried by the supervisor with backoff
+    std::set<std::wstring> unrestoredGroups;
+
+    void supervisor();
+    HRESULT keepAlive();
+    bool restoreConnection(size_t parallelism);
+    bool restoreGroups(bool all, size_t parallelism);
+    bool hasUnrestoredGroups();
+    void requestReconnect(const std::string &cause);
+    void watchConnection(OPCGroup *group);
+
 public:
     explicit OPCClient(easyopcda::ASyncCallback func);
+    // asynchronous calls run on executor, normally the one owned by OPCInit
+    OPCClient(easyopcda::ASyncCallback func, OPCExecutor *executor);
     ~OPCClient();
 
     void setOPCServerHostAndUser(std::wstring hostName,const std::wstring& domain, const std::wstring& user, const std::wstring& password);
     bool listDAServers(const std::wstring &spec);
+    // scans the hosts concurrently for DA 1.0, 2.0 and 3.0 servers on up to parallelism workers of the executor.
+    // hosts not answering within timeoutMs (0: no limit) are left out: their enumerations not yet started are
+    // dropped, those already waiting on the host finish in background
+    std::vector<easyopcda::opcDiscoveredServer> discoverServers(const std::vector<std::wstring> &hosts, DWORD timeoutMs, size_t parallelism);
+    // file where discoverServers keeps the progIDs of the scanned hosts. connectToOPCByProgID looks progIDs up
+    // there until they are older than ttlSeconds
+    void setDiscoveryCache(const std::wstring &path, DWORD ttlSeconds);
     bool connectToOPCByProgID(const std::wstring &progID);
     void connectToOPCByClsid(const CLSID &clsid);
-    OPCGroup* addGroup(std::wstring, DWORD);
+    // number of server instances opened by the next connect, and how groups are spread over them.
+    // servers that serialise calls per connection then serve groups on different connections in parallel
+    void setServerConnections(size_t connections, easyopcda::opcGroupPlacement placement);
+    // the priority orders the delivery of the group batches when the channel is loaded, see subscribe
+    OPCGroup* addGroup(std::wstring, DWORD, easyopcda::opcPriority priority = easyopcda::opcPriority::normal);
     OPCGroup* getGroup(const std::wstring&);
     void removeGroup(std::wstring);
 
+    // create or tear down many groups concurrently on up to parallelism threads: the calling one and workers
+    // of the bulk pool, see setBulkThreads.
+    // the result has one status per requested group, in request order
+    std::vector<HRESULT> addGroups(const std::vector<easyopcda::opcGroupDef> &definitions, size_t parallelism);
+    std::vector<HRESULT> removeGroups(const std::vector<std::wstring> &names, size_t parallelism);
+    // ids tagging the batches of the delivery channel. 0: no such group
+    uint32_t getGroupId(const std::wstring &name);
+    std::wstring getGroupName(uint32_t groupId);
+    // overall time allowed to removeGroup, removeGroups and the destructor for closing the groups (default 5 s).
+    // server calls still blocked then are abandoned, see OPCGroup::shutdown
+    void setShutdownDeadline(DWORD deadlineMs);
+    // workers of the pool running addGroups, removeGroups and the group restore. the pool is created on first use,
+    // by default with as many workers as the parallelism of that first call, which bounds the later ones.
+    // 0 runs them on the executor instead, where groups are torn down one at a time within the shutdown deadline.
+    // must come before the first of those calls
+    void setBulkThreads(size_t threads);
+
+    // the blocking calls above, run on the executor. without one, the client creates its own on first use
+    OPCExecutor *getExecutor();
+    std::future<bool> connectToOPCByProgIDAsync(const std::wstring &progID);
+    std::future<OPCGroup*> addGroupAsync(const std::wstring &name, DWORD requestedUpdateRate);
+    std::future<void> removeGroupAsync(const std::wstring &name);
+    // any other work against the server, e.g. [group] { group->syncReadGroup(); }
+    template<typename F>
+    auto submit(F func) -> std::future<decltype(func())> { return getExecutor()->submit(std::move(func)); }
+
+    // polls groups with syncReadGroup, for servers whose subscriptions are unreliable. the thread pool is
+    // created on the first startPolling: setPolling (threads, jitter as a fraction of the period) must come before
+    void setPolling(size_t threads, double jitterFraction);
+    void startPolling(const std::wstring &name, DWORD periodMs);
+    void stopPolling(const std::wstring &name);
+    bool getPollStats(const std::wstring &name, easyopcda::opcPollStats &stats);
+
+    // detects the loss of the server (ShutdownRequest, calls failing with RPC_E_DISCONNECTED and alike, keep-alive
+    // failures) and reconnects with exponential backoff, recreating every group and its items. groups failing to
+    // be recreated on an available server are retried with the same backoff, staying reconnecting meanwhile
+    void enableReconnect(const easyopcda::opcReconnectPolicy &policy);
+    void disableReconnect();
+    easyopcda::opcReconnectStats getReconnectStats();
+    // told of every loss of the server detected by the groups, whether or not reconnection is enabled.
+    // called from COM threads: it must not call into the client
+    void setConnectionLostCallback(std::function<void(const std::string &cause)> callback);
+    // one stream of the values of every group, as one batch per group callback tagged with the group id.
+    // batches are queued on the COM thread and delivered on a work-stealing pool, in order within a group and in
+    // parallel across groups, higher priority groups first. the callback passed to the constructor is still called
+    // and may be empty
+    void subscribe(easyopcda::BatchCallback callback, const easyopcda::opcDeliveryOptions &options);
+    // delivers the batches already queued, then stops
+    void unsubscribe();
+    easyopcda::opcChannelStats getChannelStats();
+    // bounds the values of the group waiting in the channel (default: block without limit). kept across subscribe
+    void setOverflowPolicy(const std::wstring &name, const easyopcda::opcOverflowOptions &options);
+    bool getOverflowStats(const std::wstring &name, easyopcda::opcOverflowStats &stats);
+    // GetStatus on the first server connection
+    HRESULT getServerState(OPCSERVERSTATE &state);
+
+    // polls GetStatus on the first server connection. the callback is called on state transitions, from the
+    // monitor thread
+    void startHealthMonitor(const easyopcda::opcHealthPolicy &policy, easyopcda::ServerHealthCallback callback);
+    void stopHealthMonitor();
+    bool getServerHealth(easyopcda::opcServerHealth &health);
+    bool isServerThrottled() const {return serverThrottled;}
+
     bool isError() const {return error;}
     /*
     std::string getLogs() {
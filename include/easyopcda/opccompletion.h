@@ -0,0 +1,98 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#ifndef OPCCOMPLETION_H
+#define OPCCOMPLETION_H
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Handle to the result of an asynchronous transaction. Copies share the same state.
+// The result is set once, by the thread completing the transaction (usually a DCOM callback thread).
+template<typename T>
+class OPCCompletion {
+private:
+    struct sharedState {
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool done = false;
+        T result;
+        std::vector<std::function<void(const T &)>> continuations;
+    };
+    std::shared_ptr<sharedState> state;
+
+public:
+    OPCCompletion() : state(std::make_shared<sharedState>()) {}
+
+    bool isReady() const {
+        std::lock_guard<std::mutex> lock(state->mutex);
+        return state->done;
+    }
+
+    void wait() const {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        state->cv.wait(lock, [this] { return state->done; });
+    }
+
+    // returns true if the transaction completed within the given time
+    template<typename Rep, typename Period>
+    bool waitFor(const std::chrono::duration<Rep, Period> &timeout) const {
+        std::unique_lock<std::mutex> lock(state->mutex);
+        return state->cv.wait_for(lock, timeout, [this] { return state->done; });
+    }
+
+    // waits for completion and returns the result
+    const T &get() const {
+        wait();
+        return state->result;
+    }
+
+    // registers a function called with the result on the completing thread, or immediately on the calling
+    // thread if the transaction already completed. continuations run in registration order
+    OPCCompletion &then(std::function<void(const T &)> func) {
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (!state->done) {
+                state->continuations.push_back(std::move(func));
+                return *this;
+            }
+        }
+        func(state->result);
+        return *this;
+    }
+
+    // sets the result, wakes up waiters and runs continuations. only the first call has effect
+    bool complete(T value) {
+        std::vector<std::function<void(const T &)>> continuations;
+        {
+            std::lock_guard<std::mutex> lock(state->mutex);
+            if (state->done) return false;
+            state->result = std::move(value);
+            state->done = true;
+            continuations.swap(state->continuations);
+        }
+        state->cv.notify_all();
+        for (auto &func : continuations) func(state->result);
+        return true;
+    }
+};
+
+#endif //OPCCOMPLETION_H
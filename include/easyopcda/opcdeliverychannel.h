@@ -0,0 +1,118 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#ifndef OPCDELIVERYCHANNEL_H
+#define OPCDELIVERYCHANNEL_H
+
+#include "easyopcda.h"
+#include "opcstealingexecutor.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Queues the batches of many groups and delivers them to one callback. Every group has a serial lane: its
+// batches are delivered one at a time and in order, while the lanes of different groups run in parallel on a
+// work-stealing pool. A lane waiting for a turn is itself the pool task, so idle workers steal lanes. A lane
+// delivers at most batchesPerTurn batches, then is posted again behind the others, so a busy group cannot hold a
+// thread while others wait. With the weighted policy a turn delivers batchesPerTurn times the weight of the
+// priority; with the strict policy a lane finding a higher priority waiting is parked until none is.
+// Each lane has its own lock. push blocks the COM thread calling it only for a group whose overflow policy is block.
+class OPCDeliveryChannel {
+private:
+    // newest value of an item of a coalescing lane, indexed by client handle
+    struct coalescedSlot {
+        bool dirty = false;
+        easyopcda::opcTagValue value;
+    };
+
+    struct lane {
+        std::mutex mutex; // guards the lane. taken before statsMutex
+        // callbacks blocked by the full lane wait for a turn to take values out of it
+        std::condition_variable space;
+        std::deque<std::pair<std::chrono::steady_clock::time_point, easyopcda::opcGroupBatch>> batches;
+        size_t level = 0;
+        bool scheduled = false; // posted, parked or running. level and priority are fixed meanwhile
+        easyopcda::opcOverflowOptions overflow = {easyopcda::opcOverflowPolicy::block, 0};
+        easyopcda::opcOverflowStats stats = {0, 0, 0, 0, 0};
+        // coalesce policy: slots written since the last turn, in order of first write
+        uint32_t groupId = 0;
+        easyopcda::opcPriority priority = easyopcda::opcPriority::normal;
+        std::vector<coalescedSlot> slots;
+        std::vector<OPCHANDLE> dirty;
+        std::chrono::steady_clock::time_point dirtySince;
+
+        bool empty() const { return batches.empty() && dirty.empty(); }
+    };
+
+    easyopcda::BatchCallback callback;
+    easyopcda::opcDeliveryOptions options;
+
+    // guards the map only
+    std::mutex lanesMutex;
+    std::map<uint32_t, std::shared_ptr<lane>> lanes;
+
+    std::mutex idleMutex;
+    std::condition_variable idleCv;
+    std::atomic<size_t> lanesScheduled;
+    // lanes posted or parked and not yet running their turn, by priority level
+    std::atomic<size_t> waiting[easyopcda::priorityLevels];
+    // strict policy: lanes that found a higher priority waiting, by priority level
+    std::mutex parkedMutex;
+    std::vector<std::vector<std::shared_ptr<lane>>> parked;
+
+    std::mutex statsMutex;
+    std::vector<easyopcda::opcPriorityStats> priorityStats;
+    std::atomic<uint64_t> valuesDropped;
+    std::atomic<uint64_t> valuesCoalesced;
+
+    std::atomic<uint64_t> batchesDelivered;
+    std::atomic<uint64_t> valuesDelivered;
+    std::atomic<size_t> batchesQueued;
+    std::atomic<size_t> maxBatchesQueued;
+
+    OPCStealingExecutor pool;
+
+    std::shared_ptr<lane> laneOf(uint32_t groupId);
+    void coalesce(lane &current, easyopcda::opcGroupBatch &batch);
+    bool makeRoom(lane &current, size_t count, std::unique_lock<std::mutex> &lock);
+    void post(const std::shared_ptr<lane> &current);
+    bool higherWaiting(size_t level) const;
+    void unparkReady();
+    void runTurn(const std::shared_ptr<lane> &current);
+
+public:
+    OPCDeliveryChannel(easyopcda::BatchCallback callback, const easyopcda::opcDeliveryOptions &options);
+    // delivers the batches already queued, then stops the pool
+    ~OPCDeliveryChannel();
+    OPCDeliveryChannel(const OPCDeliveryChannel &) = delete;
+    OPCDeliveryChannel &operator=(const OPCDeliveryChannel &) = delete;
+
+    void push(easyopcda::opcGroupBatch &&batch);
+    // the lane of a removed group is dropped once its queued batches are delivered
+    void removeGroup(uint32_t groupId);
+    void setOverflow(uint32_t groupId, const easyopcda::opcOverflowOptions &options);
+    bool getOverflowStats(uint32_t groupId, easyopcda::opcOverflowStats &stats);
+    easyopcda::opcChannelStats getStats();
+};
+
+#endif //OPCDELIVERYCHANNEL_H
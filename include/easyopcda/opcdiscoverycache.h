@@ -0,0 +1,54 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#ifndef OPCDISCOVERYCACHE_H
+#define OPCDISCOVERYCACHE_H
+
+#include "easyopcda.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+// progID to CLSID maps of scanned hosts, persisted to a file so that a restarted process connects without
+// a new discovery. the entries of a host expire ttlSeconds after the host was scanned
+class OPCDiscoveryCache {
+private:
+    struct cacheEntry {
+        CLSID clsid;
+        long long scannedAt; // seconds since the Unix epoch
+    };
+
+    std::mutex mutex;
+    std::wstring path;
+    long long ttlSeconds;
+    std::map<std::pair<std::wstring, std::wstring>, cacheEntry> entries; // by (host, progID)
+
+    void load();
+    void save();
+
+public:
+    OPCDiscoveryCache(std::wstring path, DWORD ttlSeconds);
+
+    bool lookup(const std::wstring &host, const std::wstring &progID, CLSID &clsid);
+    // replaces the entries of a scanned host and saves the file
+    void storeHost(const std::wstring &host, const std::vector<easyopcda::opcDiscoveredServer> &servers);
+};
+
+#endif //OPCDISCOVERYCACHE_H
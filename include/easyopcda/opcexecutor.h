@@ -0,0 +1,88 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#ifndef OPCEXECUTOR_H
+#define OPCEXECUTOR_H
+
+#include "easyopcda.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads initialized in the COM multithreaded apartment, running tasks in FIFO order.
+// Tasks queued when the executor is destroyed still run before the workers are joined.
+// A lane has no threads of its own: it runs its tasks in FIFO order on the workers of a parent executor, at most
+// threads at a time, queueing itself again behind the other tasks of the parent after each one.
+class OPCExecutor {
+private:
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable idleCv;
+    std::deque<std::function<void()>> tasks;
+    std::vector<std::thread> workers;
+    size_t busy;
+    bool running;
+
+    OPCExecutor *parent;
+    size_t laneThreads;
+    size_t laneRunning; // runLane calls queued or running on the parent
+
+    void worker(size_t index);
+    void runLane();
+
+public:
+    OPCExecutor(std::string name, size_t threads);
+    // a lane of parent, which must outlive it
+    OPCExecutor(std::string name, OPCExecutor &parent, size_t threads);
+    ~OPCExecutor();
+
+    OPCExecutor(const OPCExecutor &) = delete;
+    OPCExecutor &operator=(const OPCExecutor &) = delete;
+
+    // queues a task. returns false once the executor is shutting down
+    bool post(std::function<void()> task);
+    // queues a task and returns the future of its result. once the executor is shutting down
+    // the task runs on the calling thread instead
+    template<typename F>
+    auto submit(F func) -> std::future<decltype(func())> {
+        auto task = std::make_shared<std::packaged_task<decltype(func())()>>(std::move(func));
+        auto result = task->get_future();
+        if (!post([task] { (*task)(); })) (*task)();
+        return result;
+    }
+
+    // runs the tasks on up to parallelism threads, the calling one included, and returns when all of them
+    // finished. the caller runs the tasks no worker has taken, so it makes progress on a busy executor and may
+    // be one of its workers
+    void runAll(std::vector<std::function<void()>> &batch, size_t parallelism);
+
+    // waits until no task is queued or running, without stopping the executor
+    void drain();
+    // runs the queued tasks and joins the workers, or waits for them to run on the parent. called by the destructor
+    void shutdown();
+
+    size_t threadCount() const { return parent ? laneThreads : workers.size(); }
+};
+
+#endif //OPCEXECUTOR_H
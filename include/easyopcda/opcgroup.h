@@ -22,6 +22,10 @@
 #include <atlbase.h>
 
 #include "easyopcda.h"
+#include "opccompletion.h"
+#include "opcexecutor.h"
+#include "opctimer.h"
+#include "opctransactiontable.h"
 #include "opccomn.h"
 #include "opcda.h"
 
@@ -32,59 +36,271 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <memory>
+#include <atomic>
+#include <initializer_list>
+#include <chrono>
 #include <condition_variable>
+#include <functional>
 #include <mutex>
+#include <thread>
 
+// item of the group. owns the blob returned by AddItems. itemErr is the only field changed once the item is published
 struct itemDef {
+    std::wstring name;
     OPCITEMRESULT itemRes;
-    HRESULT itemErr;
-};
+    OPCHANDLE clientHandle;
+    std::atomic<HRESULT> itemErr;
 
-class OPCGroup : public IOPCDataCallback, public IOPCShutdown {
-private:
-    IOPCServer* myOPCServer;
+    itemDef(const std::wstring &name, const OPCITEMRESULT &itemRes, OPCHANDLE clientHandle, HRESULT itemErr)
+        : name(name), itemRes(itemRes), clientHandle(clientHandle), itemErr(itemErr) {}
+    itemDef(const itemDef &) = delete;
+    itemDef &operator=(const itemDef &) = delete;
+    ~itemDef() { if (itemRes.pBlob) CoTaskMemFree(itemRes.pBlob); }
+};
 
-    DWORD ReferencesCount;
+// items of the group by name and by client handle. a published table is never modified: callbacks load the
+// current table once per call and keep it, while writers publish a modified copy. an item is freed with the last
+// table referring to it
+struct itemTable {
+    std::map<std::wstring, std::shared_ptr<itemDef>> byName;
+    std::vector<std::shared_ptr<itemDef>> byClientHandle; // indexed by client handle
 
-    std::wstring myName;
+    itemDef *find(OPCHANDLE clientHandle) const {
+        return clientHandle < byClientHandle.size() ? byClientHandle[clientHandle].get() : nullptr;
+    }
+    itemDef *find(const std::wstring &name) const {
+        auto it = byName.find(name);
+        return it == byName.end() ? nullptr : it->second.get();
+    }
+};
 
-    bool error;
-    //std::stringstream ss;
-    //std::shared_ptr<spdlog::sinks::ostream_sink_mt> ss_sink;
-    //std::shared_ptr<spdlog::logger> logger;
+// server handles, client handles and names of the items without error, in name order. a published set is
+// never modified: readers keep the pointer they got while the group publishes a new one
+struct activeItemSet {
+    std::vector<OPCHANDLE> serverHandles;
+    std::vector<OPCHANDLE> clientHandles;
+    std::vector<std::wstring> names;
+};
 
+// interfaces of the group on one server connection. a published set is only changed by the lazy query of
+// IOPCSyncIO: every call loads the current set once and keeps it, so that reconnect can publish the interfaces
+// of a new connection while calls are still using the proxies of the lost one
+struct groupInterfaces {
+    ATL::CComPtr<IOPCServer> server;
+    OPCHANDLE groupHandle = 0;
     ATL::CComPtr<IOPCGroupStateMgt> groupMgr;
     ATL::CComPtr<IOPCItemMgt> itemMgr;
-    ATL::CComPtr<IOPCSyncIO> syncIO;
     ATL::CComPtr<IOPCSyncIO2> syncIO2;
-    ATL::CComPtr<IOPCAsyncIO> asyncIO;
     ATL::CComPtr<IOPCAsyncIO2> asyncIO2;
     ATL::CComPtr<IOPCAsyncIO3> asyncIO3;
-
     ATL::CComPtr<IConnectionPointContainer> connectionPointContainer;
     ATL::CComPtr<IConnectionPoint> asyncDataCallbackConnectionPoint;
     ATL::CComPtr<IConnectionPoint> shutdownConnectionPoint;
-    DWORD asyncCallbackHandle;
-    DWORD shutdownHandle;
+    DWORD asyncCallbackHandle = 0;
+    DWORD shutdownHandle = 0;
+    DWORD roundTrips = 0;
+
+    // IOPCSyncIO is only queried when the server lacks IOPCSyncIO2
+    std::mutex syncIOMutex;
+    bool syncIOQueried = false;
+    ATL::CComPtr<IOPCSyncIO> syncIO;
+};
+
+// values of a write request converted to the items canonical types, ready to be passed to the server
+struct writeBuffer {
+    bool vqt = false;
+    std::vector<OPCHANDLE> serverHandles;
+    std::vector<OPCHANDLE> clientHandles;
+    std::vector<size_t> itemIndexes;
+    std::vector<VARIANT> values;
+    std::vector<OPCITEMVQT> vqtValues;
+
+    writeBuffer() = default;
+    writeBuffer(const writeBuffer &) = delete;
+    writeBuffer &operator=(const writeBuffer &) = delete;
+    ~writeBuffer() {
+        for (size_t k = 0; k < serverHandles.size(); k++) {
+            VariantClear(vqt ? &vqtValues[k].vDataValue : &values[k]);
+        }
+    }
+};
+
+// pending asynchronous write: per-item results in request order, completed from OnWriteComplete
+struct writeTransaction {
+    std::vector<std::pair<OPCHANDLE, size_t>> clientHandleIndexes; // sorted by client handle
+    std::vector<HRESULT> results;
+    std::vector<bool> answered; // in request order: the server returned a result for the item
+    OPCCompletion<std::vector<HRESULT>> completion;
+};
+
+// pending asynchronous read: values delivered by OnReadComplete for this transaction only
+struct readTransaction {
+    easyopcda::opcReadResult result = {S_OK, {}};
+    OPCCompletion<easyopcda::opcReadResult> completion;
+    std::chrono::steady_clock::time_point issueTime;
+};
+
+// payload of a transaction slot: a read or a write
+struct asyncTransaction {
+    bool isRead = false;
+    uint64_t deadlineTimer = 0; // timer entry of the deadline, cancelled when the transaction finishes
+    readTransaction read;
+    writeTransaction write;
+};
+
+// write waiting in the write queue: the last value queued for a tag and everybody who queued one in the window
+struct queuedWrite {
+    easyopcda::opcWriteValue value;
+    std::vector<OPCCompletion<HRESULT>> submitters;
+};
 
+class OPCGroup : public IOPCDataCallback, public IOPCShutdown {
+private:
+    DWORD requestedUpdateRate;
+
+    std::atomic<ULONG> ReferencesCount;
+
+    std::wstring myName;
+
+    std::atomic<easyopcda::opcGroupState> state;
+    // moves to the state if the group is in one of the from states
+    bool changeState(std::initializer_list<easyopcda::opcGroupState> from, easyopcda::opcGroupState to);
+    bool acceptsRequests() const;
+    void degrade();
+
+    // server callbacks in progress, waited for by shutdown until its deadline. each holds a reference to the group
+    std::atomic<size_t> callbacksInFlight;
+    std::mutex callbackDrainMutex;
+    std::condition_variable callbackDrainCv;
+    bool enterCallback(bool whileClosing);
+    void leaveCallback();
+
+    std::mutex shutdownMutex;
+    std::atomic<bool> shutdownDone;
+    easyopcda::opcShutdownReport shutdownReport;
+    OPCExecutor *executor;
+    size_t shutdownCalls(std::vector<std::function<void()>> &calls, size_t parallelism, std::chrono::steady_clock::time_point deadline);
+    // set when a call fails because the server is gone, or on ShutdownRequest. the handler is told once per loss
+    std::atomic<bool> connectionLost;
+    std::function<void(const std::string &cause)> connectionLostHandler;
+    void checkConnection(HRESULT hr);
+    // restored by reconnect
+    std::atomic<bool> autoReadEnabled;
+    //std::stringstream ss;
+    //std::shared_ptr<spdlog::sinks::ostream_sink_mt> ss_sink;
+    //std::shared_ptr<spdlog::logger> logger;
+
+    // published with atomic_store, replaced by reconnect and emptied by shutdown
+    std::shared_ptr<groupInterfaces> interfaces;
+    std::shared_ptr<groupInterfaces> loadInterfaces() const { return std::atomic_load(&interfaces); }
+    IOPCSyncIO *getSyncIO(groupInterfaces &itf);
+
+    COAUTHIDENTITY *authIdent;
+    // creates the group on the server and publishes its interfaces, also those acquired before a failure
+    HRESULT attachToServer(CComPtr<IOPCServer> &server);
+    HRESULT createGroup(groupInterfaces &itf);
+    void setProxyBlanket(IUnknown *proxy, const char *interfaceName);
+    void queryGroupInterfaces(groupInterfaces &itf, MULTI_QI *qiList, ULONG count);
+
+    // async transactions in flight, looked up by transaction ID from the callbacks without locking
+    OPCTransactionTable<asyncTransaction, 8> transactions;
+
+    // idleCv is notified when the last transaction completes
     std::mutex transactionMutex;
-    DWORD lastClientTransactionID;
-    std::map<DWORD,DWORD> clientServerTransactionID;
-    std::condition_variable cv;
+    std::condition_variable idleCv;
 
-    OPCHANDLE thisGroupHandle;
+    // every async transaction gets a deadline on the timer of the client, shared by all its groups. the expiry
+    // runs on the executor; deadlines whose transaction already completed are recognized by their stale ID
+    std::atomic<DWORD> transactionTimeout;
+    OPCTimer *timer;
 
-    std::map<std::wstring,itemDef> itemsMap;
+    std::atomic<uint64_t> transactionsIssued;
+    std::atomic<uint64_t> transactionsCompleted;
+    std::atomic<uint64_t> transactionsCancelled;
+    std::atomic<uint64_t> transactionsTimedOut;
+
+    // async reads in flight are bounded by readWindow, adapted between 1 and maxReadsInFlight (0: unbounded)
+    // from the observed completion latency: additive increase, halved when latency builds up or reads time out.
+    // readWindowMutex is only taken while the window is enabled
+    std::mutex readWindowMutex;
+    std::condition_variable readWindowCv;
+    std::atomic<DWORD> maxReadsInFlight;
+    bool blockOnReadWindowFull;
+    std::atomic<DWORD> readsInFlight;
+    DWORD readWindow;
+    DWORD readWindowCredit;
+    double readLatencyMin;
+    std::atomic<double> readLatencyAverage;
+    std::chrono::steady_clock::time_point lastReadWindowDecrease;
+    std::atomic<uint64_t> readsRejected;
+
+    void releaseReadSlot(std::chrono::steady_clock::time_point issueTime, bool congested);
+
+    // a transaction slot is owned by one thread at a time: the issuing thread until the server call returned,
+    // then whoever claims it (callback, cancel or expiry) and completes it
+    DWORD registerTransaction(bool isRead);
+    transactionPhase claimForIssuer(DWORD transactionID);
+    void completeIssue(DWORD transactionID, transactionPhase claim, bool anyAccepted, DWORD serverCancelID);
+    transactionPhase claimForCallback(DWORD transactionID);
+    void finishTransaction(DWORD transactionID, HRESULT transactionError, bool congested);
+    void cancelServerTransaction(DWORD transactionID, DWORD serverCancelID);
+    void expireTransaction(DWORD transactionID);
+
+    // writers of the item table (addItems, validateItems, reconnect) are serialised by itemsMutex
+    std::mutex itemsMutex;
+    std::shared_ptr<const itemTable> currentItems;
     std::map<OPCHANDLE,std::wstring> serverItemHandlesMap;
     OPCHANDLE lastClientItemHandle;
-    std::map<OPCHANDLE,std::wstring> clientItemHandlesMap;
+    std::atomic<size_t> itemCount;
+
+    std::shared_ptr<const itemTable> loadItems() const { return std::atomic_load(&currentItems); }
+    void publishItems(std::shared_ptr<const itemTable> table);
+
+    // rebuilt on first use after items are added, removed or change error state
+    std::shared_ptr<activeItemSet> activeItems;
+    std::atomic<uint64_t> activeItemsVersion;
+    std::shared_ptr<activeItemSet> getActiveItems();
+    void invalidateActiveItems();
 
     easyopcda::ASyncCallback externalAsyncCallback;
+    // receives the values of every callback as one batch. published with atomic_store, loaded once per callback
+    uint32_t groupId;
+    easyopcda::opcPriority priority;
+    std::shared_ptr<const std::function<void(easyopcda::opcGroupBatch &&batch)>> batchSink;
+
+    // a window is flushed on the executor when its timer fires or it is full, by one flush at a time.
+    // writeQueueCv is notified when a flush ends or starts waiting for an async write
+    std::mutex writeQueueMutex;
+    std::condition_variable writeQueueCv;
+    bool writeQueueRunning;
+    bool writeQueueFlushing;
+    bool writeQueueAwaiting; // the flush waits for an async write to complete
+    DWORD writeQueueWindow;
+    size_t writeQueueMaxItems;
+    std::vector<queuedWrite> queuedWrites;
+    std::map<std::wstring,size_t> queuedWriteIndexes;
+    std::chrono::steady_clock::time_point writeQueueWindowStart;
+
+    bool writeQueueDue() const;
+    void flushWriteQueue();
+    void writeDueWindows();
+    void scheduleWriteFlush(std::chrono::steady_clock::time_point time);
+    // a reference to the group, released with the last copy
+    std::shared_ptr<OPCGroup> holdReference();
+    HRESULT completeWrite(DWORD transactionID, HRESULT masterError, DWORD count, OPCHANDLE *clientHandles, HRESULT *errors);
+
+    HRESULT prepareWriteValue(const itemTable &table, const easyopcda::opcWriteValue &item, VARIANT &dest, const itemDef *&def);
+    void prepareWriteBuffer(std::vector<easyopcda::opcWriteValue> &items, bool vqtAvailable, writeBuffer &buffer, std::vector<HRESULT> &results);
 
 public:
     DWORD realUpdateRate;
 
-    OPCGroup(std::wstring name, CComPtr<IOPCServer> &pOPCServer, COAUTHIDENTITY *pAuthIdent, DWORD reqUpdRate, easyopcda::ASyncCallback func);
+    // the group starts with one reference, owned by the creator and dropped with Release. the server holds more
+    // while it is advised, so a group whose Unadvise was abandoned is freed when the server lets go of it.
+    // the server calls of shutdown and the transaction expiries run on executor, the deadlines on timer
+    OPCGroup(std::wstring name, CComPtr<IOPCServer> &pOPCServer, COAUTHIDENTITY *pAuthIdent, DWORD reqUpdRate, easyopcda::ASyncCallback func,
+             OPCExecutor *executor, OPCTimer *timer);
     virtual ~OPCGroup();
 
     void validateItems(std::vector<std::wstring> &inputItems);
@@ -96,8 +312,20 @@ public:
 
     void syncReadItems(std::vector<std::wstring> &items);
     void syncReadGroup();
-    void asyncReadGroup();
+    OPCCompletion<easyopcda::opcReadResult> asyncReadGroup();
     void waitForTransactionsComplete();
+    bool waitForTransactionsComplete(DWORD timeoutMs);
+
+    // closes the group within deadlineMs: unadvises the callbacks, cancels the pending transactions in parallel,
+    // removes the group from the server and waits for the callbacks in progress. server calls still blocked at
+    // the deadline are abandoned. called by the destructor with a 5 s deadline if not called before
+    easyopcda::opcShutdownReport shutdown(DWORD deadlineMs);
+
+    // transactions not answered within timeoutMs are cancelled with Cancel2 and fail with ERROR_TIMEOUT. 0 disables
+    void setTransactionTimeout(DWORD timeoutMs);
+    // bounds the async reads in flight. when the window is full asyncReadGroup waits, or fails with ERROR_BUSY
+    void setMaxReadsInFlight(DWORD maxInFlight, bool blockWhenFull);
+    easyopcda::opcGroupMetrics getMetrics();
 
     // implementation of IUNKOWN
     STDMETHODIMP QueryInterface(REFIID iid, LPVOID *ppInterface) override;
@@ -116,9 +344,35 @@ public:
 
     HRESULT internalAsyncCallback(DWORD count, OPCHANDLE *clientHandles, VARIANT *values, WORD *quality, FILETIME *time,HRESULT *errors);
 
-    void syncWriteItems(std::vector<std::wstring> &items, std::vector<double> values);
+    std::vector<HRESULT> syncWriteItems(std::vector<easyopcda::opcWriteValue> &items);
+    OPCCompletion<std::vector<HRESULT>> asyncWriteItems(std::vector<easyopcda::opcWriteValue> &items);
+
+    // writes queued from any thread are collected for windowMs or up to maxItems tags and sent as one write.
+    // only the last value of a tag within a window is written; all its submitters get the result of that write.
+    // the writes run on the executor of the group, the windows are timed by its timer
+    void enableWriteQueue(DWORD windowMs, size_t maxItems);
+    void disableWriteQueue();
+    OPCCompletion<HRESULT> queueWrite(const easyopcda::opcWriteValue &value);
+
+    // called from a COM thread when the server connection is lost; must not call back into the group
+    void setConnectionLostHandler(std::function<void(const std::string &cause)> handler);
+    // recreates the group and its items on a new server connection, requesting the canonical types returned by
+    // the lost server, and restores the active state. blobs are not reused: the new server returns its own.
+    // pending transactions fail with RPC_E_DISCONNECTED
+    HRESULT reconnect(CComPtr<IOPCServer> &pOPCServer);
+
+    // set by OPCClient. the sink is called on the COM thread and must not block
+    void setGroupId(uint32_t id) {groupId = id;}
+    uint32_t getGroupId() const {return groupId;}
+    void setPriority(easyopcda::opcPriority value) {priority = value;}
+    easyopcda::opcPriority getPriority() const {return priority;}
+    void setBatchSink(std::function<void(easyopcda::opcGroupBatch &&batch)> sink);
 
-    bool isError() const {return error;}
+    size_t getItemCount() const {return itemCount;}
+    bool isConnectionLost() const {return connectionLost;}
+    easyopcda::opcGroupState getState() const {return state;}
+    // true unless inactive or active
+    bool isError() const;
     /*
     std::string getLogs() {
         auto rv = ss.str();
@@ -0,0 +1,58 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#ifndef OPCHEALTHMONITOR_H
+#define OPCHEALTHMONITOR_H
+
+#include <atlbase.h>
+
+#include "easyopcda.h"
+#include "opcda.h"
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// Calls IOPCServer::GetStatus at a fixed period on its own thread, and keeps the reported server state, group
+// count and bandwidth with a histogram of the call latency. The callback is called on the monitor thread
+// when reachability, server state or throttling change.
+class OPCHealthMonitor {
+private:
+    std::function<CComPtr<IOPCServer>()> serverSource;
+    easyopcda::opcHealthPolicy policy;
+    easyopcda::ServerHealthCallback callback;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::thread monitorThread;
+    bool running;
+    easyopcda::opcServerHealth health;
+
+    void monitor();
+    void check();
+    bool isThrottled(const easyopcda::opcServerHealth &current) const;
+
+public:
+    // serverSource returns the server connection to check, or nullptr while not connected
+    OPCHealthMonitor(std::function<CComPtr<IOPCServer>()> serverSource, const easyopcda::opcHealthPolicy &policy, easyopcda::ServerHealthCallback callback);
+    ~OPCHealthMonitor();
+
+    easyopcda::opcServerHealth getHealth();
+};
+
+#endif //OPCHEALTHMONITOR_H
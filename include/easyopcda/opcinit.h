@@ -19,6 +19,7 @@
 
 #include "easyopcda.h"
 #include "OPCClient.h"
+#include "opcexecutor.h"
 
 #include "spdlog/spdlog.h"
 #include "spdlog/sinks/ostream_sink.h"
@@ -35,8 +36,11 @@ private:
 
     OPCClient * mClient;
     easyopcda::ASyncCallback mCallbackFunc;
+    OPCExecutor * mExecutor;
 public:
     explicit OPCInit(easyopcda::ASyncCallback func);
+    // threads: workers of the executor shared by the client for asynchronous calls
+    OPCInit(easyopcda::ASyncCallback func, size_t threads);
     ~OPCInit();
 
     bool isError() {return error;}
@@ -51,6 +55,8 @@ public:
     */
 
     OPCClient* getClient();
+    // MTA-initialised workers: every call made through them has COM initialised and does not block the caller
+    OPCExecutor* getExecutor();
 };
 
 
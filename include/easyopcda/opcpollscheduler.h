@@ -0,0 +1,91 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#ifndef OPCPOLLSCHEDULER_H
+#define OPCPOLLSCHEDULER_H
+
+#include "easyopcda.h"
+#include "opcexecutor.h"
+#include "opcgroup.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+// group polled by the scheduler. nextDue is the intended start of the next read, without jitter
+struct polledGroup {
+    OPCGroup *group;
+    std::chrono::milliseconds period;
+    std::chrono::steady_clock::time_point nextDue;
+    std::chrono::steady_clock::time_point lastStart;
+    uint64_t schedule; // changes when the group is rescheduled; older heap entries are discarded
+    bool running;
+    bool removed;
+    bool throttleSkip;
+    easyopcda::opcPollStats stats;
+};
+
+// Runs syncReadGroup on many groups at their own period from one timer thread and a small executor.
+// The first read of a group is delayed by a random phase offset within its period, and every read by a random
+// jitter, so groups with the same period do not read at the same instant. A cycle that comes due while the
+// previous read of the group is still running is skipped.
+class OPCPollScheduler {
+private:
+    typedef std::pair<std::chrono::steady_clock::time_point, std::pair<uint64_t, std::shared_ptr<polledGroup>>> pollEntry;
+    struct pollEntryLater {
+        bool operator()(const pollEntry &a, const pollEntry &b) const { return a.first > b.first; }
+    };
+
+    OPCExecutor executor;
+    double jitterFraction;
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::condition_variable idleCv;
+    std::map<std::wstring, std::shared_ptr<polledGroup>> groups;
+    std::priority_queue<pollEntry, std::vector<pollEntry>, pollEntryLater> due;
+    std::minstd_rand random;
+    std::thread timerThread;
+    bool running;
+    std::function<bool()> throttled;
+
+    void timer();
+    void poll(std::shared_ptr<polledGroup> entry);
+    std::chrono::steady_clock::duration jitter(std::chrono::milliseconds period);
+
+public:
+    // jitterFraction: maximum delay of a read as a fraction of the group period
+    OPCPollScheduler(size_t threads, double jitterFraction);
+    ~OPCPollScheduler();
+
+    // starts polling the group, or changes its period
+    void startPolling(const std::wstring &name, OPCGroup *group, DWORD periodMs);
+    // stops polling the group and waits for its read in progress
+    void stopPolling(const std::wstring &name);
+    bool getPollStats(const std::wstring &name, easyopcda::opcPollStats &stats);
+    // while throttled() is true every other cycle is skipped. called by the timer thread
+    void setThrottle(std::function<bool()> throttled);
+};
+
+#endif //OPCPOLLSCHEDULER_H
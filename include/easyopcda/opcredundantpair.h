@@ -0,0 +1,112 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#ifndef OPCREDUNDANTPAIR_H
+#define OPCREDUNDANTPAIR_H
+
+#include "easyopcda.h"
+#include "opcclient.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Two identical OPC servers serving the same groups. Both subscriptions are active: values of the active server
+// go to the callback, the values of the standby server newer than the last delivered one are queued per tag,
+// up to maxStandbyValues. On failover the standby becomes active and all its queued values are delivered first,
+// oldest first. Values lost only if a tag overflowed its queue (standbyValuesOverflowed).
+// A value is delivered only if its timestamp is newer than the last one delivered for the tag, so that none is
+// duplicated. This assumes both servers stamp a sample with the same source timestamp, e.g. from the device.
+// Servers stamping with their own clocks need a skew tolerance: values of the other server within it of the
+// last delivered one are taken as the same sample. It must stay below the sampling period of the tags.
+// Failover is triggered by ShutdownRequest and disconnection errors of the active server, or by the monitor
+// finding it unreachable or not running with GetStatus.
+class OPCRedundantPair {
+private:
+    static constexpr size_t maxStandbyValues = 64;
+
+    struct tagState {
+        uint64_t lastDelivered = 0; // FILETIME of the last value delivered
+        size_t lastServer = 0; // server whose clock stamped lastDelivered
+        std::deque<easyopcda::opcTagValue> standby; // by timestamp, all newer than lastDelivered
+    };
+
+    OPCClient *clients[2];
+    easyopcda::ASyncCallback mCallbackFunc;
+
+    // guards the tag states, the active server and the outbox
+    std::mutex deliveryMutex;
+    std::atomic<size_t> activeServer;
+    std::map<std::pair<std::wstring, std::wstring>, tagState> tags;
+    uint64_t skewTolerance; // FILETIME units
+    easyopcda::opcFailoverStats stats;
+    // values to deliver, queued in delivery order under deliveryMutex and passed to the callback by one thread at
+    // a time with no lock held, so that the callback may call back into the pair
+    std::deque<std::pair<std::wstring, easyopcda::opcTagValue>> outbox;
+    bool draining;
+    void drainOutbox(std::unique_lock<std::mutex> &lock);
+
+    std::mutex monitorMutex;
+    std::condition_variable monitorCv;
+    std::thread monitorThread;
+    bool monitorRunning;
+    DWORD checkPeriodMs;
+    bool failoverRequested;
+    std::string failoverCause;
+    // set by the COM threads, the monitor and failover, read by switchServer
+    std::atomic<std::chrono::steady_clock::time_point> failureTime;
+
+    bool alreadyDelivered(const tagState &tag, size_t server, uint64_t timestamp) const;
+    void deliver(size_t server, const std::wstring &groupName, const easyopcda::opcTagResult &result);
+    void connectionLost(size_t server, const std::string &cause);
+    bool serverHealthy(size_t server);
+    void switchServer(size_t from, const std::string &cause);
+    void monitor();
+
+public:
+    explicit OPCRedundantPair(easyopcda::ASyncCallback func);
+    ~OPCRedundantPair();
+
+    // 0 primary, 1 secondary: host, user and connection are set on each client
+    OPCClient *getClient(size_t server);
+
+    // creates the group on both servers, adds the items and activates both subscriptions
+    bool addGroup(const std::wstring &name, DWORD updateRate, std::vector<std::wstring> &items);
+    void removeGroup(const std::wstring &name);
+    // the group on the active server, for reads and writes
+    OPCGroup *getGroup(const std::wstring &name);
+
+    // checks the active server with GetStatus every checkPeriodMs
+    void startMonitor(DWORD checkPeriodMs);
+    void stopMonitor();
+    // switches to the standby server
+    void failover(const std::string &cause);
+    // for servers stamping values with their own clocks. 0 (default) when both report the source timestamp
+    void setSkewTolerance(DWORD skewToleranceMs);
+
+    size_t getActiveServer() const {return activeServer;}
+    easyopcda::opcFailoverStats getFailoverStats();
+};
+
+#endif //OPCREDUNDANTPAIR_H
@@ -0,0 +1,103 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#ifndef OPCSERVERMANAGER_H
+#define OPCSERVERMANAGER_H
+
+#include "easyopcda.h"
+#include "opcclient.h"
+#include "opcexecutor.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Owns the clients of many OPC servers. Work on a server is submitted to its lane, which runs at most
+// threadsPerServer tasks at a time on a pool shared by all servers: a slow or hung server delays its own lane
+// only, and the process needs maxThreads workers however many servers it connects to. The asynchronous calls of
+// each client run on a lane executor of the same pool, bounded by threadsPerServer as well.
+// The values of all servers go through one bounded queue to a single delivery thread calling the callback.
+class OPCServerManager {
+private:
+    struct serverLane {
+        OPCClient *client = nullptr;
+        std::unique_ptr<OPCExecutor> executor; // of the client
+        std::deque<std::function<void(OPCClient *)>> tasks;
+        size_t running = 0;
+        bool removing = false;
+    };
+
+    struct managedValue {
+        std::wstring server;
+        std::wstring group;
+        easyopcda::opcTagValue value;
+    };
+
+    easyopcda::ManagedCallback mCallbackFunc;
+    easyopcda::opcManagerLimits limits;
+    OPCExecutor pool;
+
+    std::mutex serversMutex;
+    std::condition_variable laneIdleCv;
+    std::map<std::wstring, std::shared_ptr<serverLane>> servers;
+
+    std::mutex deliveryMutex;
+    std::condition_variable deliveryCv;
+    std::deque<managedValue> queued;
+    std::thread deliveryThread;
+    bool deliveryRunning;
+    easyopcda::opcManagerStats stats;
+
+    bool schedule(const std::wstring &name, std::function<void(OPCClient *)> task);
+    void runLane(std::shared_ptr<serverLane> lane);
+    void enqueue(const std::wstring &server, const std::wstring &group, const easyopcda::opcTagResult &result);
+    void deliver();
+
+public:
+    OPCServerManager(easyopcda::ManagedCallback func, const easyopcda::opcManagerLimits &limits);
+    ~OPCServerManager();
+
+    // the client is configured and connected through submit, or directly from a thread of the caller
+    OPCClient *addServer(const std::wstring &name);
+    // waits for the tasks running on the server; its queued tasks are abandoned
+    void removeServer(const std::wstring &name);
+    OPCClient *getServer(const std::wstring &name);
+    std::vector<std::wstring> getServerNames();
+
+    // runs func(client) on the lane of the server. the future is abandoned (broken promise) when the server
+    // is unknown or removed before the task runs
+    // the clients run on the same pool: a task must not wait on client->submit
+    template<typename F>
+    auto submit(const std::wstring &name, F func) -> std::future<decltype(func(static_cast<OPCClient *>(nullptr)))> {
+        typedef decltype(func(static_cast<OPCClient *>(nullptr))) resultType;
+        auto task = std::make_shared<std::packaged_task<resultType(OPCClient *)>>(std::move(func));
+        auto result = task->get_future();
+        schedule(name, [task](OPCClient *client) { (*task)(client); });
+        return result;
+    }
+
+    easyopcda::opcManagerStats getStats();
+};
+
+#endif //OPCSERVERMANAGER_H
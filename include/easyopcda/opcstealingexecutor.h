@@ -0,0 +1,74 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#ifndef OPCSTEALINGEXECUTOR_H
+#define OPCSTEALINGEXECUTOR_H
+
+#include "easyopcda.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fixed pool of worker threads in the COM multithreaded apartment, each with its own task queue. A task posted
+// from a worker goes to that worker's queue, other tasks are spread in turn. A worker runs its own queue in FIFO
+// order and, when it is empty, steals from the back of the others. Tasks queued at shutdown still run.
+class OPCStealingExecutor {
+private:
+    struct worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+        std::thread thread;
+    };
+
+    std::string name;
+    std::vector<std::unique_ptr<worker>> workers;
+    std::atomic<size_t> nextWorker;
+    std::atomic<uint64_t> steals;
+
+    // pending counts the tasks posted and not yet taken; idle workers wait for it
+    std::mutex idleMutex;
+    std::condition_variable idleCv;
+    size_t pending;
+    bool running;
+
+    bool take(size_t index, std::function<void()> &task);
+    void run(size_t index);
+
+public:
+    OPCStealingExecutor(std::string name, size_t threads);
+    ~OPCStealingExecutor();
+
+    OPCStealingExecutor(const OPCStealingExecutor &) = delete;
+    OPCStealingExecutor &operator=(const OPCStealingExecutor &) = delete;
+
+    // queues a task. returns false once the executor is shutting down
+    bool post(std::function<void()> task);
+    // runs the queued tasks and joins the workers. called by the destructor
+    void shutdown();
+
+    size_t threadCount() const { return workers.size(); }
+    uint64_t stealCount() const { return steals; }
+};
+
+#endif //OPCSTEALINGEXECUTOR_H
@@ -0,0 +1,74 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#ifndef OPCTIMER_H
+#define OPCTIMER_H
+
+#include "easyopcda.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// One thread running functions at their scheduled time, kept in a min-heap. The functions run on the timer
+// thread, so they must only hand their work over, e.g. post it to an executor. Functions still scheduled when
+// the timer is shut down are dropped without running.
+// A cancelled function is dropped at once; its heap entry is skipped when due, and the heap is compacted when
+// such entries outnumber the live ones.
+class OPCTimer {
+private:
+    struct timerEntry {
+        std::chrono::steady_clock::time_point time;
+        uint64_t sequence; // entries due at the same time run in scheduling order. also the id of the function
+    };
+    struct timerEntryLater {
+        bool operator()(const timerEntry &a, const timerEntry &b) const {
+            return a.time > b.time || (a.time == b.time && a.sequence > b.sequence);
+        }
+    };
+
+    std::string name;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<timerEntry> due; // heap ordered by timerEntryLater
+    std::unordered_map<uint64_t, std::function<void()>> functions; // scheduled and not cancelled, by id
+    uint64_t nextSequence;
+    std::thread timerThread;
+    bool running;
+
+    void timer();
+
+public:
+    explicit OPCTimer(std::string name);
+    ~OPCTimer();
+
+    OPCTimer(const OPCTimer &) = delete;
+    OPCTimer &operator=(const OPCTimer &) = delete;
+
+    // returns the id of the function, 0 once the timer is shutting down
+    uint64_t schedule(std::chrono::steady_clock::time_point time, std::function<void()> func);
+    // drops the function unless it already ran. ids are never reused
+    void cancel(uint64_t id);
+    // joins the thread and drops the scheduled functions. called by the destructor
+    void shutdown();
+};
+
+#endif //OPCTIMER_H
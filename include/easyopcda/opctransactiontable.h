@@ -0,0 +1,138 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#ifndef OPCTRANSACTIONTABLE_H
+#define OPCTRANSACTIONTABLE_H
+
+#include <atomic>
+#include <memory>
+
+#include <windows.h>
+
+// phase of a transaction slot. the thread that moves a slot into a phase owning the payload is the only one
+// touching the payload until it moves the slot on
+enum class transactionPhase : DWORD {
+    free = 0,
+    issuing,       // the issuing thread is in the server call
+    issuerWriting, // the server call returned, the issuing thread records the items it rejected
+    pending,       // waiting for the server callback
+    earlyWriting,  // the callback arrived before the server call returned and records its results
+    earlyDone,     // callback results recorded, the issuing thread completes the transaction
+    abandoned,     // timed out before the server call returned, the issuing thread completes the transaction
+    claimed,       // a callback, a cancel or the watchdog completes the transaction
+    stale          // not a slot phase: the transaction ID refers to a previous use of the slot
+};
+
+// Fixed-capacity table of asynchronous transactions. A transaction ID is the slot index in the low SlotBits
+// bits and the generation of the slot above them, so it is never 0 and a late callback for a reused slot is
+// recognized as stale. Slot phases change with compare-and-swap; lookups are an index and a load.
+template<typename Payload, DWORD SlotBits>
+class OPCTransactionTable {
+public:
+    static constexpr DWORD capacity = 1u << SlotBits;
+
+private:
+    static constexpr DWORD phaseBits = 4;
+    static constexpr DWORD indexMask = capacity - 1;
+    static constexpr DWORD generationMask = (1u << (32 - SlotBits)) - 1;
+
+    static_assert(SlotBits >= 1 && SlotBits <= 16, "slot index must leave room for the generation");
+
+    struct slot {
+        std::atomic<DWORD> state; // generation << phaseBits | phase
+        std::atomic<DWORD> serverCancelID;
+        Payload payload;
+    };
+
+    std::unique_ptr<slot[]> slots;
+    std::atomic<DWORD> cursor;
+    std::atomic<DWORD> outstanding;
+
+    static DWORD makeState(DWORD generation, transactionPhase phase) { return (generation << phaseBits) | static_cast<DWORD>(phase); }
+    static DWORD generationOf(DWORD state) { return state >> phaseBits; }
+    static transactionPhase phaseOfState(DWORD state) { return static_cast<transactionPhase>(state & ((1u << phaseBits) - 1)); }
+    static DWORD nextGeneration(DWORD generation) {
+        generation = (generation + 1) & generationMask;
+        return generation ? generation : 1;
+    }
+    slot &slotOf(DWORD transactionID) { return slots[transactionID & indexMask]; }
+
+public:
+    OPCTransactionTable() : slots(new slot[capacity]), cursor(0), outstanding(0) {
+        for (DWORD i = 0; i < capacity; i++) {
+            slots[i].state.store(makeState(1, transactionPhase::free), std::memory_order_relaxed);
+            slots[i].serverCancelID.store(0, std::memory_order_relaxed);
+        }
+    }
+    OPCTransactionTable(const OPCTransactionTable &) = delete;
+    OPCTransactionTable &operator=(const OPCTransactionTable &) = delete;
+
+    // takes a free slot in phase issuing and returns its transaction ID, or 0 when every slot is in use
+    DWORD acquire() {
+        for (DWORD n = 0; n < capacity; n++) {
+            DWORD index = cursor.fetch_add(1, std::memory_order_relaxed) & indexMask;
+            DWORD state = slots[index].state.load(std::memory_order_relaxed);
+            if (phaseOfState(state) != transactionPhase::free) continue;
+            if (slots[index].state.compare_exchange_strong(state, makeState(generationOf(state), transactionPhase::issuing), std::memory_order_acquire)) {
+                outstanding.fetch_add(1, std::memory_order_relaxed);
+                slots[index].serverCancelID.store(0, std::memory_order_relaxed);
+                return (generationOf(state) << SlotBits) | index;
+            }
+        }
+        return 0;
+    }
+
+    transactionPhase phase(DWORD transactionID) {
+        DWORD state = slotOf(transactionID).state.load(std::memory_order_acquire);
+        if (generationOf(state) != (transactionID >> SlotBits)) return transactionPhase::stale;
+        return phaseOfState(state);
+    }
+
+    // moves the transaction from one phase to another. fails if it is in another phase or the ID is stale
+    bool transition(DWORD transactionID, transactionPhase from, transactionPhase to) {
+        DWORD expected = makeState(transactionID >> SlotBits, from);
+        return slotOf(transactionID).state.compare_exchange_strong(expected, makeState(transactionID >> SlotBits, to), std::memory_order_acq_rel);
+    }
+
+    // hands the payload over from its owner to the next phase
+    void publish(DWORD transactionID, transactionPhase to) {
+        slotOf(transactionID).state.store(makeState(transactionID >> SlotBits, to), std::memory_order_release);
+    }
+
+    // frees the slot; its ID becomes stale. returns true when no other transaction is outstanding
+    bool release(DWORD transactionID) {
+        slotOf(transactionID).state.store(makeState(nextGeneration(transactionID >> SlotBits), transactionPhase::free), std::memory_order_release);
+        return outstanding.fetch_sub(1, std::memory_order_acq_rel) == 1;
+    }
+
+    Payload &payload(DWORD transactionID) { return slotOf(transactionID).payload; }
+
+    void setServerCancelID(DWORD transactionID, DWORD serverCancelID) { slotOf(transactionID).serverCancelID.store(serverCancelID, std::memory_order_relaxed); }
+    DWORD serverCancelID(DWORD transactionID) { return slotOf(transactionID).serverCancelID.load(std::memory_order_relaxed); }
+
+    DWORD outstandingCount() const { return outstanding.load(std::memory_order_acquire); }
+
+    // calls func(transactionID) for every transaction waiting for the server callback
+    template<typename Func>
+    void forEachPending(Func func) {
+        for (DWORD index = 0; index < capacity; index++) {
+            DWORD state = slots[index].state.load(std::memory_order_acquire);
+            if (phaseOfState(state) == transactionPhase::pending) func((generationOf(state) << SlotBits) | index);
+        }
+    }
+};
+
+#endif //OPCTRANSACTIONTABLE_H
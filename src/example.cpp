@@ -43,11 +43,18 @@ int main(int argc, char **argv) {
 	client->connectToOPCByProgID(L"Matrikon.OPC.Simulation.1");
 
 	auto group = client->addGroup(L"gp1",10000);
-	std::vector<std::wstring> items = {L"Random.Real8",L"Random.String",L"Random.Int4"};
+	std::vector<std::wstring> items = {L"Random.Real8",L"Random.String",L"Random.Int4",L"Bucket Brigade.Real8",L"Bucket Brigade.Int4"};
 	group->addItems(items);
 
+	std::vector<easyopcda::opcWriteValue> writeValues = {{L"Bucket Brigade.Real8", 12.5}, {L"Bucket Brigade.Int4", 42}};
+	group->syncWriteItems(writeValues);
+
 	group->syncReadGroup();
-	group->asyncReadGroup();
+	auto readResult = group->asyncReadGroup();
+	readResult.then([](const easyopcda::opcReadResult &result) {
+		spdlog::info("async read completed with {} values, status: {}", result.values.size(), hresultToUTF8(result.error));
+	});
+	readResult.waitFor(std::chrono::seconds(10));
 
 	group->waitForTransactionsComplete();
 
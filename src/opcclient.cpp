@@ -21,27 +21,69 @@
 
 #include "spdlog/spdlog.h"
 
+#include <algorithm>
+#include <deque>
 #include <locale>
+#include <set>
 #include <string>
 #include <map>
 
 #include <atlbase.h>
 
 
-OPCClient::OPCClient(easyopcda::ASyncCallback func)
+OPCClient::OPCClient(easyopcda::ASyncCallback func) : OPCClient(std::move(func), nullptr) {}
+
+OPCClient::OPCClient(easyopcda::ASyncCallback func, OPCExecutor *executor)
 //: ss_sink(std::make_shared<spdlog::sinks::ostream_sink_mt>(ss)),
 //  logger(std::make_shared<spdlog::logger>("easyopcda", ss_sink))
 {
     error=false;
+    this->executor = executor;
+    ownedExecutor = nullptr;
+    timer = nullptr;
+    bulkExecutor = nullptr;
+    bulkThreads = 0;
+    bulkThreadsSet = false;
     pOPCServer=nullptr;
+    connectionCount = 1;
+    groupPlacement = easyopcda::opcGroupPlacement::roundRobin;
+    nextConnection = 0;
     identitySet = false;
     mCallbackFunc = std::move(func);
+    pollScheduler = nullptr;
+    pollThreads = 4;
+    pollJitter = 0.1;
+    shutdownDeadlineMs = 5000;
+    nextGroupId = 1;
+    healthMonitor = nullptr;
+    serverThrottled = false;
+    discoveryCache = nullptr;
+    supervisorRunning = false;
+    reconnectRequested = false;
+    reconnectPolicy = {10000, 500, 30000, 8};
+    reconnectStats = {0, 0, 0, 0, 0, true};
 }
 
+// groups torn down in parallel when the client is destroyed
+static const size_t shutdownParallelism = 8;
+
 OPCClient::~OPCClient() {
+    unsubscribe();
+    disableReconnect();
+    stopHealthMonitor();
+    delete pollScheduler;
+    std::vector<OPCGroup *> doomed;
     for(auto i=groups.begin();i!=groups.end();++i) {
-        delete i->second;
+        doomed.push_back(i->second);
     }
+    groups.clear();
+    groupNames.clear();
+    destroyGroups(doomed, shutdownParallelism);
+    delete bulkExecutor;
+    // drops the deadlines still scheduled and their references to the groups
+    delete timer;
+    delete discoveryCache;
+    delete ownedExecutor;
 }
 
 void OPCClient::setOPCServerHostAndUser(std::wstring hostName, const std::wstring& domain, const std::wstring& user, const std::wstring &password) {
@@ -97,6 +139,21 @@ void OPCClient::setOPCServerHostAndUser(std::wstring hostName, const std::wstrin
 }
 
 
+// CLSIDs fetched from the enumerator per round trip
+static const ULONG discoveryBatch = 64;
+
+static void nextCLSIDs(IEnumCLSID *iEnum, std::vector<CLSID> &clsids) {
+    CLSID batch[discoveryBatch];
+    ULONG cActual = 0;
+    HRESULT hr;
+    do {
+        cActual = 0;
+        hr = iEnum->Next(discoveryBatch, batch, &cActual);
+        if FAILED(hr) break;
+        clsids.insert(clsids.end(), batch, batch + cActual);
+    } while (hr == S_OK && cActual == discoveryBatch);
+}
+
 bool OPCClient::listDAServers(const std::wstring &spec) {
     if (error) {
         ERROR_LOG("Client in error state cannot further process requests");
@@ -142,9 +199,9 @@ bool OPCClient::listDAServers(const std::wstring &spec) {
                 ERROR_LOG("CoSetProxyBlanket failed on the ICatInformation with error = {}", hresultToUTF8(hrAuth));
             }
 
-            ULONG cActual;
-            CLSID clsid;
-            while(iEnum->Next(1, &clsid, &cActual) == S_OK)
+            std::vector<CLSID> clsids;
+            nextCLSIDs(iEnum, clsids);
+            for (auto &clsid : clsids)
             {
                 LPOLESTR progID = nullptr;
                 LPOLESTR userType = nullptr;
@@ -173,6 +230,206 @@ bool OPCClient::listDAServers(const std::wstring &spec) {
     return true;
 }
 
+// hosts are scanned and cached by name, localhost when none is set
+static std::wstring discoveryHost(const std::wstring &host) {
+    return host.empty() ? L"localhost" : host;
+}
+
+// state of a discovery shared with its runners, which outlive discoverServers on the hosts that time out
+struct discoveryScan {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t pending = 0;
+    std::deque<std::pair<size_t, size_t>> work; // host and category of the enumerations not yet started
+    bool abandoned = false;
+    std::vector<std::wstring> hosts;
+    std::vector<std::map<std::string, easyopcda::opcDiscoveredServer>> servers; // per host, by CLSID
+    std::vector<size_t> hostPending;
+    std::vector<HRESULT> hostErrors;
+    bool identitySet = false;
+    std::wstring domain;
+    std::wstring user;
+    std::wstring password;
+};
+
+// enumerates one category on one host. the first category finding a server asks for its details
+static void scanHostCategory(const std::shared_ptr<discoveryScan> &scan, size_t host, size_t category) {
+    static const CATID categories[3] = {CATID_OPCDAServer10, CATID_OPCDAServer20, CATID_OPCDAServer30};
+
+    COAUTHIDENTITY identity;
+    COAUTHINFO authInfo;
+    COSERVERINFO info;
+    ZeroMemory(&identity, sizeof(COAUTHIDENTITY));
+    ZeroMemory(&authInfo, sizeof(COAUTHINFO));
+    ZeroMemory(&info, sizeof(COSERVERINFO));
+    info.pwszName = const_cast<LPWSTR>(scan->hosts[host].c_str());
+    if (scan->identitySet) {
+        identity.User = const_cast<USHORT *>(reinterpret_cast<const USHORT *>(scan->user.c_str()));
+        identity.UserLength = (ULONG) scan->user.length();
+        identity.Password = const_cast<USHORT *>(reinterpret_cast<const USHORT *>(scan->password.c_str()));
+        identity.PasswordLength = (ULONG) scan->password.length();
+        identity.Domain = const_cast<USHORT *>(reinterpret_cast<const USHORT *>(scan->domain.c_str()));
+        identity.DomainLength = (ULONG) scan->domain.length();
+        identity.Flags = SEC_WINNT_AUTH_IDENTITY_UNICODE;
+        authInfo.dwAuthnSvc = RPC_C_AUTHN_WINNT;
+        authInfo.dwAuthzSvc = RPC_C_AUTHZ_NONE;
+        authInfo.dwAuthnLevel = RPC_C_AUTHN_LEVEL_PKT_INTEGRITY;
+        authInfo.dwImpersonationLevel = RPC_C_IMP_LEVEL_IMPERSONATE;
+        authInfo.dwCapabilities = EOAC_NONE;
+        authInfo.pAuthIdentityData = &identity;
+        info.pAuthInfo = &authInfo;
+    }
+    COAUTHIDENTITY *auth = scan->identitySet ? &identity : nullptr;
+
+    ATL::CComPtr<IOPCServerList> iCatInfo;
+    std::vector<CLSID> clsids;
+    HRESULT hr = OPCServerListCreateInstance(&info, auth, scan->hosts[host] == L"localhost", iCatInfo);
+    if SUCCEEDED(hr) {
+        CATID implemented[1] = {categories[category]};
+        ATL::CComPtr<IEnumCLSID> iEnum;
+        hr = iCatInfo->EnumClassesOfCategories(1, implemented, 0, nullptr, &iEnum);
+        if SUCCEEDED(hr) {
+            CoSetProxyBlanket(iEnum, RPC_C_AUTHN_WINNT, RPC_C_AUTHZ_NONE, NULL, RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, RPC_C_IMP_LEVEL_IMPERSONATE, auth, EOAC_NONE);
+            nextCLSIDs(iEnum, clsids);
+        }
+    }
+
+    for (auto &clsid : clsids) {
+        easyopcda::opcDiscoveredServer *server;
+        {
+            std::lock_guard<std::mutex> lock(scan->mutex);
+            auto inserted = scan->servers[host].emplace(GUIDToUTF8(clsid), easyopcda::opcDiscoveredServer{scan->hosts[host], L"", L"", clsid, false, false, false});
+            server = &inserted.first->second;
+            if (category == 0) server->da10 = true;
+            else if (category == 1) server->da20 = true;
+            else server->da30 = true;
+            if (!inserted.second) continue;
+        }
+
+        LPOLESTR progID = nullptr;
+        LPOLESTR userType = nullptr;
+        HRESULT result = iCatInfo->GetClassDetails(clsid, &progID, &userType);
+        if (SUCCEEDED(result) && progID) {
+            std::lock_guard<std::mutex> lock(scan->mutex);
+            server->progID = progID;
+            server->userType = userType ? userType : L"";
+        }
+        if (progID) CoTaskMemFree(progID);
+        if (userType) CoTaskMemFree(userType);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(scan->mutex);
+        if FAILED(hr) scan->hostErrors[host] = hr;
+        scan->hostPending[host]--;
+        scan->pending--;
+    }
+    scan->done.notify_all();
+}
+
+// runs the enumerations of a scan one after the other until none is left or the scan is abandoned
+static void runDiscoveryScan(const std::shared_ptr<discoveryScan> &scan) {
+    while (true) {
+        std::pair<size_t, size_t> next;
+        {
+            std::lock_guard<std::mutex> lock(scan->mutex);
+            if (scan->abandoned || scan->work.empty()) return;
+            next = scan->work.front();
+            scan->work.pop_front();
+        }
+        scanHostCategory(scan, next.first, next.second);
+    }
+}
+
+std::vector<easyopcda::opcDiscoveredServer> OPCClient::discoverServers(const std::vector<std::wstring> &hosts, DWORD timeoutMs, size_t parallelism) {
+    std::vector<easyopcda::opcDiscoveredServer> discovered;
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return discovered;
+    }
+    if (hosts.empty()) return discovered;
+
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread discovering OPC servers on {} hosts: {}", hosts.size(), hid);
+
+    auto scan = std::make_shared<discoveryScan>();
+    for (auto &host : hosts) scan->hosts.push_back(discoveryHost(host));
+    scan->servers.resize(hosts.size());
+    scan->hostPending.assign(hosts.size(), 3);
+    scan->hostErrors.assign(hosts.size(), S_OK);
+    scan->pending = hosts.size() * 3;
+    scan->identitySet = identitySet;
+    scan->domain = domain;
+    scan->user = user;
+    scan->password = password;
+
+    // the three categories of every host are enumerated concurrently, by at most parallelism runners of this scan
+    for (size_t host = 0; host < hosts.size(); host++) {
+        for (size_t category = 0; category < 3; category++) scan->work.emplace_back(host, category);
+    }
+    size_t runners = std::min(std::max<size_t>(1, parallelism), scan->work.size());
+    size_t posted = 0;
+    for (size_t i = 0; i < runners; i++) {
+        if (getExecutor()->post([scan] { runDiscoveryScan(scan); })) posted++;
+    }
+    if (posted == 0) {
+        std::lock_guard<std::mutex> lock(scan->mutex);
+        for (auto &item : scan->work) {
+            scan->hostErrors[item.first] = E_ABORT;
+            scan->hostPending[item.first]--;
+            scan->pending--;
+        }
+        scan->work.clear();
+    }
+
+    std::vector<std::pair<std::wstring, std::vector<easyopcda::opcDiscoveredServer>>> scanned;
+    {
+        std::unique_lock<std::mutex> lock(scan->mutex);
+        auto finished = [&scan] { return scan->pending == 0; };
+        if (timeoutMs == 0) scan->done.wait(lock, finished);
+        else scan->done.wait_for(lock, std::chrono::milliseconds(timeoutMs), finished);
+        // the runners stop taking enumerations, so that hosts timing out only hold the workers already waiting on them
+        scan->abandoned = true;
+        scan->work.clear();
+
+        for (size_t host = 0; host < hosts.size(); host++) {
+            if (scan->hostPending[host] > 0) {
+                WARN_LOG("Discovery on host {} timed out after {} ms", wstringToUTF8(scan->hosts[host]), timeoutMs);
+                continue;
+            }
+            std::vector<easyopcda::opcDiscoveredServer> hostServers;
+            for (auto &it : scan->servers[host]) {
+                if (!it.second.progID.empty()) hostServers.push_back(it.second);
+            }
+            discovered.insert(discovered.end(), hostServers.begin(), hostServers.end());
+            if FAILED(scan->hostErrors[host]) {
+                WARN_LOG("Discovery on host {} failed. Error: {}", wstringToUTF8(scan->hosts[host]), hresultToUTF8(scan->hostErrors[host]));
+            } else {
+                scanned.emplace_back(scan->hosts[host], std::move(hostServers));
+            }
+        }
+    }
+
+    for (auto &host : scanned) {
+        for (auto &server : host.second) {
+            INFO_LOG("Discovered server >>>{}<<< {} on {} CLSID >>>{}<<<", wstringToUTF8(server.progID), wstringToUTF8(server.userType), wstringToUTF8(host.first), GUIDToUTF8(server.clsid));
+            if (host.first == discoveryHost(hostName)) progIDtoCLSIDMap[server.progID] = server.clsid;
+        }
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        if (discoveryCache) discoveryCache->storeHost(host.first, host.second);
+    }
+
+    INFO_LOG("Discovered {} servers on {} of {} hosts", discovered.size(), scanned.size(), hosts.size());
+    return discovered;
+}
+
+void OPCClient::setDiscoveryCache(const std::wstring &path, DWORD ttlSeconds) {
+    std::lock_guard<std::mutex> lock(discoveryMutex);
+    delete discoveryCache;
+    discoveryCache = new OPCDiscoveryCache(path, ttlSeconds);
+}
+
 
 bool OPCClient::connectToOPCByProgID(const std::wstring &progID) {
     if (error) {
@@ -188,7 +445,17 @@ bool OPCClient::connectToOPCByProgID(const std::wstring &progID) {
         return false;
     }
 
-    if (progIDtoCLSIDMap.count(serverProgID)==0) {
+    CLSID cachedClsid;
+    bool cached = false;
+    {
+        std::lock_guard<std::mutex> lock(discoveryMutex);
+        if (discoveryCache) cached = discoveryCache->lookup(discoveryHost(hostName), serverProgID, cachedClsid);
+    }
+
+    if (progIDtoCLSIDMap.count(serverProgID)==0 && cached) {
+        INFO_LOG("Requested progID {} found in the discovery cache", wstringToUTF8(serverProgID));
+        serverCLSID = cachedClsid;
+    } else if (progIDtoCLSIDMap.count(serverProgID)==0) {
         WARN_LOG("Requested progID {} could not be found; attempting to look for clsid again", wstringToUTF8(serverProgID));
         CLSID sClsid;
         HRESULT hrGetProcID = CLSIDFromProgID ( serverProgID.c_str(), &sClsid );
@@ -205,9 +472,7 @@ bool OPCClient::connectToOPCByProgID(const std::wstring &progID) {
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread connecting to OPC server: {}", hid);
 
-    HRESULT hrOPCServerInstance = OPCServerCreateInstance(&serverInfo,identitySet?&authIdent:nullptr,hostName==L"localhost",serverCLSID,pOPCServer);
-    if FAILED(hrOPCServerInstance) {
-        ERROR_LOG("CoCreateInstanceEx could not create instance of interface IID_OPCServer from requested class");
+    if (!openServerConnections()) {
         error=true;
         return false;
     }
@@ -230,15 +495,70 @@ void OPCClient::connectToOPCByClsid(const CLSID &clsid) {
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread connecting to OPC server: {}",hid);
 
-    HRESULT hrOPCServerInstance = OPCServerCreateInstance(&serverInfo,identitySet?&authIdent:nullptr,hostName==L"localhost",serverCLSID,pOPCServer);
-    if FAILED(hrOPCServerInstance) {
-        ERROR_LOG("CoCreateInstanceEx could not create instance of interface IID_OPCServer from requested class");
+    if (!openServerConnections()) {
         error=true;
         return;
     }
 }
 
-OPCGroup* OPCClient::addGroup(std::wstring name, DWORD requestedUpdateRate) {
+void OPCClient::setServerConnections(size_t connections, easyopcda::opcGroupPlacement placement) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+    if (!serverConnections.empty()) {
+        WARN_LOG("Already connected. Server connections apply from the next connection");
+    }
+    connectionCount = connections ? connections : 1;
+    groupPlacement = placement;
+}
+
+// opens connectionCount instances of serverCLSID. only the first one is required
+bool OPCClient::openServerConnections() {
+    std::vector<CComPtr<IOPCServer>> opened;
+    for (size_t i = 0; i < connectionCount; i++) {
+        CComPtr<IOPCServer> server;
+        HRESULT hrOPCServerInstance = OPCServerCreateInstance(&serverInfo,identitySet?&authIdent:nullptr,hostName==L"localhost",serverCLSID,server);
+        if FAILED(hrOPCServerInstance) {
+            if (i == 0) {
+                ERROR_LOG("CoCreateInstanceEx could not create instance of interface IID_OPCServer from requested class");
+                return false;
+            }
+            WARN_LOG("Only {} of {} connections to the OPC server could be opened", i, connectionCount);
+            break;
+        }
+        opened.push_back(server);
+    }
+
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    serverConnections = std::move(opened);
+    pOPCServer = serverConnections[0];
+    if (serverConnections.size() > 1) INFO_LOG("{} connections to the OPC server opened", serverConnections.size());
+    return true;
+}
+
+// chooses the connection of a new group. must be called with groupsMutex held
+size_t OPCClient::placeGroup(const std::wstring &name) {
+    size_t index = 0;
+    if (serverConnections.size() > 1) {
+        if (groupPlacement == easyopcda::opcGroupPlacement::roundRobin) {
+            index = nextConnection++ % serverConnections.size();
+        } else {
+            // groups being created count with no items
+            std::vector<std::pair<size_t, size_t>> load(serverConnections.size(), {0, 0});
+            for (auto &it : groupConnections) {
+                auto group = groups.find(it.first);
+                if (group != groups.end()) load[it.second].first += group->second->getItemCount();
+                load[it.second].second++;
+            }
+            index = std::min_element(load.begin(), load.end()) - load.begin();
+        }
+    }
+    groupConnections[name] = index;
+    return index;
+}
+
+OPCGroup* OPCClient::addGroup(std::wstring name, DWORD requestedUpdateRate, easyopcda::opcPriority priority) {
     if (error) {
         ERROR_LOG("Client in error state cannot further process requests");
         return nullptr;
@@ -251,15 +571,34 @@ OPCGroup* OPCClient::addGroup(std::wstring name, DWORD requestedUpdateRate) {
 
     INFO_LOG("Group name: >>>{}<<< Update rate: >>>{}<<<", wstringToUTF8(name), requestedUpdateRate);
 
-    if(groups.count(name)>0) {
-        WARN_LOG("Group with this name already exists. Skipping...");
-        return nullptr;
-    } else {
-        groups[name] = new OPCGroup(name,pOPCServer,identitySet?&authIdent:nullptr,requestedUpdateRate,mCallbackFunc);
-        INFO_LOG("Group {} created", wstringToUTF8(name));
+    size_t connection;
+    CComPtr<IOPCServer> server;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        if (groups.count(name) > 0 || groupConnections.count(name) > 0) {
+            WARN_LOG("Group with this name already exists. Skipping...");
+            return nullptr;
+        }
+        if (serverConnections.empty()) {
+            ERROR_LOG("Not connected to an OPC server");
+            return nullptr;
+        }
+        connection = placeGroup(name);
+        // the connections are replaced by the reconnect supervisor
+        server = serverConnections[connection];
     }
 
-    return groups[name];
+    auto group = new OPCGroup(name,server,identitySet?&authIdent:nullptr,requestedUpdateRate,mCallbackFunc,getExecutor(),getTimer());
+    watchConnection(group);
+    attachGroup(group, priority);
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        groups[name] = group;
+        groupNames[group->getGroupId()] = name;
+    }
+    INFO_LOG("Group {} created on connection {}", wstringToUTF8(name), connection);
+
+    return getGroup(name);
 }
 
 OPCGroup* OPCClient::getGroup(const std::wstring& name) {
@@ -268,12 +607,14 @@ OPCGroup* OPCClient::getGroup(const std::wstring& name) {
         return nullptr;
     }
 
-    if (groups.count(name) == 0) {
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    auto it = groups.find(name);
+    if (it == groups.end()) {
         ERROR_LOG("Invalid group name");
         return nullptr;
     }
 
-    return groups[name];
+    return it->second;
 }
 
 
@@ -283,13 +624,608 @@ void OPCClient::removeGroup(std::wstring name) {
         return;
     }
 
-    if (groups.count(name) == 0) {
-        ERROR_LOG("Invalid group name");
-        return;
+    // a group being restored by the supervisor is deleted once restored
+    std::lock_guard<std::mutex> recoveryLock(recoveryMutex);
+    OPCGroup *group;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        auto it = groups.find(name);
+        if (it == groups.end()) {
+            ERROR_LOG("Invalid group name");
+            return;
+        }
+        group = it->second;
+        groups.erase(it);
+        forgetGroupId(group->getGroupId());
+        groupConnections.erase(name);
     }
+    unrestoredGroups.erase(name);
+
+    if (pollScheduler) pollScheduler->stopPolling(name);
 
-    delete groups[name];
-    groups.erase(name);
+    group->shutdown(shutdownDeadlineMs);
+    // freed once the server and the callbacks in progress let go of it as well
+    group->Release();
 
     INFO_LOG("Group {} deleted",wstringToUTF8(name));
 }
+
+std::vector<HRESULT> OPCClient::addGroups(const std::vector<easyopcda::opcGroupDef> &definitions, size_t parallelism) {
+    std::vector<HRESULT> results(definitions.size(), E_FAIL);
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return results;
+    }
+
+    std::vector<OPCGroup *> created(definitions.size(), nullptr);
+    std::vector<CComPtr<IOPCServer>> servers(definitions.size());
+    std::set<std::wstring> requested;
+    std::vector<size_t> pending;
+    std::unique_lock<std::mutex> lock(groupsMutex);
+    for (size_t i = 0; i < definitions.size(); i++) {
+        const std::wstring &name = definitions[i].name;
+        if (name.empty()) {
+            ERROR_LOG("Invalid group name");
+            results[i] = E_INVALIDARG;
+        } else if (groups.count(name) > 0 || groupConnections.count(name) > 0 || !requested.insert(name).second) {
+            WARN_LOG("Group {} already exists. Skipping...", wstringToUTF8(name));
+            results[i] = HRESULT_FROM_WIN32(ERROR_ALREADY_EXISTS);
+        } else if (serverConnections.empty()) {
+            ERROR_LOG("Not connected to an OPC server");
+            results[i] = E_FAIL;
+        } else {
+            pending.push_back(i);
+            servers[i] = serverConnections[placeGroup(name)];
+        }
+    }
+    lock.unlock();
+
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread creating {} groups: {}", pending.size(), hid);
+
+    std::vector<std::function<void()>> constructions;
+    for (size_t i : pending) {
+        constructions.push_back([this, &definitions, &created, &servers, i] {
+            created[i] = new OPCGroup(definitions[i].name, servers[i], identitySet ? &authIdent : nullptr, definitions[i].updateRate, mCallbackFunc, getExecutor(), getTimer());
+            watchConnection(created[i]);
+            attachGroup(created[i], definitions[i].priority);
+        });
+    }
+    getBulkExecutor(parallelism)->runAll(constructions, parallelism);
+
+    // failed groups are released here, so that a later addGroups can retry them
+    std::vector<OPCGroup *> failed;
+    lock.lock();
+    for (size_t i : pending) {
+        if (created[i]->isError()) {
+            ERROR_LOG("Group {} could not be created", wstringToUTF8(definitions[i].name));
+            failed.push_back(created[i]);
+            groupConnections.erase(definitions[i].name);
+            results[i] = E_FAIL;
+        } else {
+            groups[definitions[i].name] = created[i];
+            groupNames[created[i]->getGroupId()] = definitions[i].name;
+            results[i] = S_OK;
+        }
+    }
+    lock.unlock();
+    destroyGroups(failed, parallelism);
+
+    INFO_LOG("{} of {} groups created", std::count(results.begin(), results.end(), S_OK), definitions.size());
+    return results;
+}
+
+std::vector<HRESULT> OPCClient::removeGroups(const std::vector<std::wstring> &names, size_t parallelism) {
+    std::vector<HRESULT> results(names.size(), E_FAIL);
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return results;
+    }
+
+    std::lock_guard<std::mutex> recoveryLock(recoveryMutex);
+    std::vector<OPCGroup *> doomed;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        for (size_t i = 0; i < names.size(); i++) {
+            auto it = groups.find(names[i]);
+            if (it == groups.end()) {
+                ERROR_LOG("Invalid group name");
+                results[i] = E_INVALIDARG;
+                continue;
+            }
+            doomed.push_back(it->second);
+            forgetGroupId(it->second->getGroupId());
+            groups.erase(it);
+            groupConnections.erase(names[i]);
+            unrestoredGroups.erase(names[i]);
+            results[i] = S_OK;
+        }
+    }
+    if (pollScheduler) {
+        for (size_t i = 0; i < names.size(); i++) {
+            if (results[i] == S_OK) pollScheduler->stopPolling(names[i]);
+        }
+    }
+
+    destroyGroups(doomed, parallelism);
+
+    INFO_LOG("{} groups deleted", doomed.size());
+    return results;
+}
+
+// shuts the groups down concurrently and releases them: each shutdown unadvises the callbacks, cancels pending
+// transactions and removes the group from the server
+void OPCClient::destroyGroups(std::vector<OPCGroup *> &doomed, size_t parallelism) {
+    if (doomed.empty()) return;
+    // the server calls of the shutdowns run on the executor, apart from the bulk workers waiting for them. with
+    // setBulkThreads(0) the shutdowns would take the workers their calls need: the calling thread runs them alone
+    OPCExecutor *workers = getBulkExecutor(parallelism);
+    if (workers == getExecutor()) parallelism = 1;
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(shutdownDeadlineMs);
+    auto shutdownGroup = [deadline](OPCGroup *group) {
+        auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        group->shutdown(static_cast<DWORD>(std::max<long long>(0, remaining)));
+        group->Release();
+    };
+    std::vector<std::function<void()>> shutdowns;
+    for (auto group : doomed) {
+        shutdowns.push_back([group, &shutdownGroup] { shutdownGroup(group); });
+    }
+    workers->runAll(shutdowns, parallelism);
+    doomed.clear();
+}
+
+uint32_t OPCClient::getGroupId(const std::wstring &name) {
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    auto it = groups.find(name);
+    return it == groups.end() ? 0 : it->second->getGroupId();
+}
+
+std::wstring OPCClient::getGroupName(uint32_t groupId) {
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    auto it = groupNames.find(groupId);
+    return it == groupNames.end() ? std::wstring() : it->second;
+}
+
+// gives the group its id and, while subscribed, connects it to the channel
+void OPCClient::attachGroup(OPCGroup *group, easyopcda::opcPriority priority) {
+    group->setGroupId(nextGroupId++);
+    group->setPriority(priority);
+    if (std::atomic_load(&channel)) {
+        group->setBatchSink([this](easyopcda::opcGroupBatch &&batch) { deliverBatch(std::move(batch)); });
+    }
+}
+
+// called with groupsMutex held
+void OPCClient::forgetGroupId(uint32_t groupId) {
+    groupNames.erase(groupId);
+    overflowOptions.erase(groupId);
+    std::shared_ptr<OPCDeliveryChannel> current = std::atomic_load(&channel);
+    if (current) current->removeGroup(groupId);
+}
+
+void OPCClient::deliverBatch(easyopcda::opcGroupBatch &&batch) {
+    std::shared_ptr<OPCDeliveryChannel> current = std::atomic_load(&channel);
+    if (current) current->push(std::move(batch));
+}
+
+void OPCClient::subscribe(easyopcda::BatchCallback callback, const easyopcda::opcDeliveryOptions &options) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+    if (!callback) {
+        ERROR_LOG("Invalid batch callback");
+        return;
+    }
+
+    std::lock_guard<std::mutex> channelLock(channelMutex);
+    if (std::atomic_load(&channel)) {
+        WARN_LOG("Delivery channel already subscribed. Skipping...");
+        return;
+    }
+    auto created = std::make_shared<OPCDeliveryChannel>(std::move(callback), options);
+    std::lock_guard<std::mutex> lock(groupsMutex);
+    for (auto &it : overflowOptions) created->setOverflow(it.first, it.second);
+    std::atomic_store(&channel, created);
+
+    // groups created meanwhile find the channel in attachGroup
+    for (auto &it : groups) {
+        it.second->setBatchSink([this](easyopcda::opcGroupBatch &&batch) { deliverBatch(std::move(batch)); });
+    }
+    INFO_LOG("Delivery channel subscribed for {} groups on {} threads", groups.size(), std::max<size_t>(1, options.threads));
+}
+
+void OPCClient::unsubscribe() {
+    std::lock_guard<std::mutex> channelLock(channelMutex);
+    std::shared_ptr<OPCDeliveryChannel> current = std::atomic_load(&channel);
+    if (!current) return;
+    std::atomic_store(&channel, std::shared_ptr<OPCDeliveryChannel>());
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        for (auto &it : groups) it.second->setBatchSink(nullptr);
+    }
+    // a callback still holding the channel keeps it until it returns; the last owner drains and stops it
+    current.reset();
+    INFO_LOG("Delivery channel unsubscribed");
+}
+
+easyopcda::opcChannelStats OPCClient::getChannelStats() {
+    std::shared_ptr<OPCDeliveryChannel> current = std::atomic_load(&channel);
+    if (!current) return {0, 0, 0, 0, 0, std::vector<easyopcda::opcPriorityStats>(easyopcda::priorityLevels, {0, 0, 0, 0}), 0, 0};
+    return current->getStats();
+}
+
+void OPCClient::setOverflowPolicy(const std::wstring &name, const easyopcda::opcOverflowOptions &options) {
+    uint32_t groupId;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        auto it = groups.find(name);
+        if (it == groups.end()) {
+            ERROR_LOG("Invalid group name");
+            return;
+        }
+        groupId = it->second->getGroupId();
+        overflowOptions[groupId] = options;
+    }
+    std::shared_ptr<OPCDeliveryChannel> current = std::atomic_load(&channel);
+    if (current) current->setOverflow(groupId, options);
+    INFO_LOG("Group {} overflow policy {} with {} values", wstringToUTF8(name), static_cast<int>(options.policy), options.maxQueuedValues);
+}
+
+bool OPCClient::getOverflowStats(const std::wstring &name, easyopcda::opcOverflowStats &stats) {
+    uint32_t groupId = getGroupId(name);
+    std::shared_ptr<OPCDeliveryChannel> current = std::atomic_load(&channel);
+    if (groupId == 0 || !current) return false;
+    return current->getOverflowStats(groupId, stats);
+}
+
+void OPCClient::setShutdownDeadline(DWORD deadlineMs) {
+    shutdownDeadlineMs = deadlineMs;
+}
+
+void OPCClient::watchConnection(OPCGroup *group) {
+    group->setConnectionLostHandler([this](const std::string &cause) { requestReconnect(cause); });
+}
+
+void OPCClient::enableReconnect(const easyopcda::opcReconnectPolicy &policy) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(supervisorMutex);
+        reconnectPolicy = policy;
+        if (reconnectPolicy.minBackoffMs == 0) reconnectPolicy.minBackoffMs = 1;
+        reconnectPolicy.maxBackoffMs = std::max(reconnectPolicy.maxBackoffMs, reconnectPolicy.minBackoffMs);
+        if (reconnectPolicy.parallelism == 0) reconnectPolicy.parallelism = 1;
+        if (supervisorRunning) {
+            supervisorCv.notify_one();
+            return;
+        }
+        supervisorRunning = true;
+    }
+    supervisorThread = std::thread(&OPCClient::supervisor, this);
+    INFO_LOG("Automatic reconnection enabled: keep-alive {} ms, backoff {} to {} ms", policy.keepAliveMs, reconnectPolicy.minBackoffMs, reconnectPolicy.maxBackoffMs);
+}
+
+void OPCClient::disableReconnect() {
+    {
+        std::lock_guard<std::mutex> lock(supervisorMutex);
+        if (!supervisorRunning) return;
+        supervisorRunning = false;
+    }
+    supervisorCv.notify_all();
+    if (supervisorThread.joinable()) supervisorThread.join();
+}
+
+easyopcda::opcReconnectStats OPCClient::getReconnectStats() {
+    std::lock_guard<std::mutex> lock(supervisorMutex);
+    return reconnectStats;
+}
+
+void OPCClient::setConnectionLostCallback(std::function<void(const std::string &cause)> callback) {
+    std::lock_guard<std::mutex> lock(supervisorMutex);
+    connectionLostCallback = std::move(callback);
+}
+
+// called by the groups, possibly from a COM thread: only wakes the supervisor
+void OPCClient::requestReconnect(const std::string &cause) {
+    std::lock_guard<std::mutex> lock(supervisorMutex);
+    if (connectionLostCallback) connectionLostCallback(cause);
+    if (!supervisorRunning) {
+        WARN_LOG("Connection to the OPC server lost ({}). Automatic reconnection is disabled", cause);
+        return;
+    }
+    if (reconnectRequested) return;
+    reconnectRequested = true;
+    reconnectCause = cause;
+    supervisorCv.notify_one();
+}
+
+static HRESULT queryServerState(IOPCServer *server, OPCSERVERSTATE &state) {
+    OPCSERVERSTATUS *status = nullptr;
+    HRESULT hr = server->GetStatus(&status);
+    if (status) {
+        state = status->dwServerState;
+        if (status->szVendorInfo) CoTaskMemFree(status->szVendorInfo);
+        CoTaskMemFree(status);
+    }
+    return hr;
+}
+
+// calls GetStatus on every server connection and returns the first failure
+HRESULT OPCClient::keepAlive() {
+    std::vector<CComPtr<IOPCServer>> servers;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        servers = serverConnections;
+    }
+    for (auto &server : servers) {
+        OPCSERVERSTATE state;
+        HRESULT hr = queryServerState(server, state);
+        if FAILED(hr) return hr;
+    }
+    return S_OK;
+}
+
+HRESULT OPCClient::getServerState(OPCSERVERSTATE &state) {
+    CComPtr<IOPCServer> server;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        server = pOPCServer;
+    }
+    if (!server) return E_POINTER;
+    return queryServerState(server, state);
+}
+
+// opens the server connections again and recreates every group on them. false while the server is unavailable
+bool OPCClient::restoreConnection(size_t parallelism) {
+    if (!openServerConnections()) return false;
+    return restoreGroups(true, parallelism);
+}
+
+// recreates every group, or only those whose last restore failed, on the current connections. groups failing
+// while the server is available are kept for a retry. false while the server is unavailable
+bool OPCClient::restoreGroups(bool all, size_t parallelism) {
+    std::lock_guard<std::mutex> recoveryLock(recoveryMutex);
+    std::vector<std::pair<std::wstring, OPCGroup *>> restoring;
+    std::vector<CComPtr<IOPCServer>> servers;
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        for (auto &it : groups) {
+            if (!all && unrestoredGroups.count(it.first) == 0) continue;
+            // fewer connections may have been opened this time
+            size_t &connection = groupConnections[it.first];
+            connection %= serverConnections.size();
+            restoring.emplace_back(it.first, it.second);
+            servers.push_back(serverConnections[connection]);
+        }
+    }
+
+    std::vector<HRESULT> results(restoring.size(), E_FAIL);
+    std::vector<std::function<void()>> reconnections;
+    for (size_t i = 0; i < restoring.size(); i++) {
+        reconnections.push_back([&restoring, &servers, &results, i] {
+            results[i] = restoring[i].second->reconnect(servers[i]);
+        });
+    }
+    getBulkExecutor(parallelism)->runAll(reconnections, parallelism);
+
+    // removed groups are not retried
+    unrestoredGroups.clear();
+    bool unavailable = false;
+    for (size_t i = 0; i < restoring.size(); i++) {
+        if SUCCEEDED(results[i]) continue;
+        if (isServerUnavailable(results[i])) unavailable = true;
+        else unrestoredGroups.insert(restoring[i].first);
+        ERROR_LOG("Group {} could not be restored. Error: {}", wstringToUTF8(restoring[i].first), hresultToUTF8(results[i]));
+    }
+    return !unavailable;
+}
+
+bool OPCClient::hasUnrestoredGroups() {
+    std::lock_guard<std::mutex> recoveryLock(recoveryMutex);
+    return !unrestoredGroups.empty();
+}
+
+void OPCClient::supervisor() {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on reconnect supervisor thread. Error code = {}", hresultToUTF8(hrInit));
+    }
+
+    std::unique_lock<std::mutex> lock(supervisorMutex);
+    DWORD retryBackoff = reconnectPolicy.minBackoffMs;
+    while (supervisorRunning) {
+        if (!reconnectRequested) {
+            auto wake = [this] { return !supervisorRunning || reconnectRequested; };
+            lock.unlock();
+            bool pending = hasUnrestoredGroups();
+            lock.lock();
+            if (pending) {
+                // groups that failed to restore on an available server are retried instead of the keep-alive
+                if (supervisorCv.wait_for(lock, std::chrono::milliseconds(retryBackoff), wake)) continue;
+                retryBackoff = std::min(retryBackoff * 2, reconnectPolicy.maxBackoffMs);
+                size_t parallelism = reconnectPolicy.parallelism;
+                lock.unlock();
+                bool available = restoreGroups(false, parallelism);
+                lock.lock();
+                if (!available && !reconnectRequested) {
+                    reconnectRequested = true;
+                    reconnectCause = "group restore: server unavailable";
+                }
+                continue;
+            }
+            if (reconnectPolicy.keepAliveMs == 0) {
+                supervisorCv.wait(lock, wake);
+                continue;
+            }
+            if (supervisorCv.wait_for(lock, std::chrono::milliseconds(reconnectPolicy.keepAliveMs), wake)) continue;
+
+            lock.unlock();
+            HRESULT hr = keepAlive();
+            lock.lock();
+            if (isServerUnavailable(hr) && !reconnectRequested) {
+                reconnectRequested = true;
+                reconnectCause = "keep-alive: " + hresultToUTF8(hr);
+            }
+            continue;
+        }
+
+        auto outageStart = std::chrono::steady_clock::now();
+        reconnectStats.outages++;
+        reconnectStats.connected = false;
+        WARN_LOG("Connection to the OPC server lost ({}). Reconnecting", reconnectCause);
+
+        DWORD backoff = reconnectPolicy.minBackoffMs;
+        size_t parallelism = reconnectPolicy.parallelism;
+        bool restored = false;
+        while (supervisorRunning) {
+            reconnectStats.attempts++;
+            lock.unlock();
+            restored = restoreConnection(parallelism);
+            lock.lock();
+            if (restored) break;
+            supervisorCv.wait_for(lock, std::chrono::milliseconds(backoff), [this] { return !supervisorRunning; });
+            backoff = std::min(backoff * 2, reconnectPolicy.maxBackoffMs);
+        }
+        // losses reported while groups were restored belong to this outage
+        reconnectRequested = false;
+        if (!restored) break;
+
+        double outageMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - outageStart).count();
+        reconnectStats.lastOutageMs = outageMs;
+        reconnectStats.maxOutageMs = std::max(reconnectStats.maxOutageMs, outageMs);
+        reconnectStats.totalOutageMs += outageMs;
+        reconnectStats.connected = true;
+        retryBackoff = reconnectPolicy.minBackoffMs;
+        INFO_LOG("Reconnected to the OPC server after an outage of {:.0f} ms", outageMs);
+    }
+    lock.unlock();
+
+    if SUCCEEDED(hrInit) CoUninitialize();
+}
+
+void OPCClient::setPolling(size_t threads, double jitterFraction) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+    if (pollScheduler) {
+        WARN_LOG("Polling already started. Settings ignored");
+        return;
+    }
+    pollThreads = threads ? threads : 1;
+    pollJitter = std::min(std::max(jitterFraction, 0.0), 1.0);
+}
+
+void OPCClient::startPolling(const std::wstring &name, DWORD periodMs) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+
+    OPCGroup *group = getGroup(name);
+    if (!group) return;
+
+    {
+        std::lock_guard<std::mutex> lock(groupsMutex);
+        if (!pollScheduler) {
+            pollScheduler = new OPCPollScheduler(pollThreads, pollJitter);
+            pollScheduler->setThrottle([this] { return serverThrottled.load(); });
+        }
+    }
+    pollScheduler->startPolling(name, group, periodMs);
+}
+
+void OPCClient::stopPolling(const std::wstring &name) {
+    if (pollScheduler) pollScheduler->stopPolling(name);
+}
+
+bool OPCClient::getPollStats(const std::wstring &name, easyopcda::opcPollStats &stats) {
+    if (!pollScheduler) return false;
+    return pollScheduler->getPollStats(name, stats);
+}
+
+void OPCClient::startHealthMonitor(const easyopcda::opcHealthPolicy &policy, easyopcda::ServerHealthCallback callback) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(healthMutex);
+    delete healthMonitor;
+    healthMonitor = new OPCHealthMonitor(
+        [this]() -> CComPtr<IOPCServer> {
+            std::lock_guard<std::mutex> lock(groupsMutex);
+            return pOPCServer;
+        },
+        policy,
+        [this, callback](const easyopcda::opcServerHealth &previous, const easyopcda::opcServerHealth &current) {
+            serverThrottled = current.throttled;
+            if (callback) callback(previous, current);
+        });
+    INFO_LOG("Health monitor started: GetStatus every {} ms", policy.periodMs);
+}
+
+void OPCClient::stopHealthMonitor() {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    delete healthMonitor;
+    healthMonitor = nullptr;
+    serverThrottled = false;
+}
+
+bool OPCClient::getServerHealth(easyopcda::opcServerHealth &health) {
+    std::lock_guard<std::mutex> lock(healthMutex);
+    if (!healthMonitor) return false;
+    health = healthMonitor->getHealth();
+    return true;
+}
+
+OPCExecutor *OPCClient::getExecutor() {
+    std::call_once(ownedExecutorOnce, [this] {
+        if (!executor) executor = ownedExecutor = new OPCExecutor("client", 2);
+    });
+    return executor;
+}
+
+void OPCClient::setBulkThreads(size_t threads) {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return;
+    }
+    if (bulkExecutor) {
+        WARN_LOG("Bulk pool already started. Settings ignored");
+        return;
+    }
+    bulkThreads = threads;
+    bulkThreadsSet = true;
+}
+
+OPCExecutor *OPCClient::getBulkExecutor(size_t parallelism) {
+    std::call_once(bulkExecutorOnce, [this, parallelism] {
+        size_t threads = bulkThreadsSet ? bulkThreads : std::max<size_t>(1, parallelism);
+        if (threads > 0) bulkExecutor = new OPCExecutor("bulk", threads);
+    });
+    return bulkExecutor ? bulkExecutor : getExecutor();
+}
+
+OPCTimer *OPCClient::getTimer() {
+    std::call_once(timerOnce, [this] { timer = new OPCTimer("transactions"); });
+    return timer;
+}
+
+std::future<bool> OPCClient::connectToOPCByProgIDAsync(const std::wstring &progID) {
+    return submit([this, progID] { return connectToOPCByProgID(progID); });
+}
+
+std::future<OPCGroup *> OPCClient::addGroupAsync(const std::wstring &name, DWORD requestedUpdateRate) {
+    return submit([this, name, requestedUpdateRate] { return addGroup(name, requestedUpdateRate); });
+}
+
+std::future<void> OPCClient::removeGroupAsync(const std::wstring &name) {
+    return submit([this, name] { removeGroup(name); });
+}
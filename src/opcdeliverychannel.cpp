@@ -0,0 +1,286 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcdeliverychannel.h"
+
+#include <algorithm>
+
+
+// turns given to each priority level, from critical to low, by the weighted policy
+static const size_t priorityWeights[easyopcda::priorityLevels] = {8, 4, 2, 1};
+
+OPCDeliveryChannel::OPCDeliveryChannel(easyopcda::BatchCallback callback, const easyopcda::opcDeliveryOptions &options)
+    : callback(std::move(callback)), options(options), lanesScheduled(0), parked(easyopcda::priorityLevels),
+      priorityStats(easyopcda::priorityLevels, {0, 0, 0, 0}), valuesDropped(0), valuesCoalesced(0),
+      batchesDelivered(0), valuesDelivered(0), batchesQueued(0), maxBatchesQueued(0),
+      pool("delivery", std::max<size_t>(1, options.threads)) {
+    if (this->options.batchesPerTurn == 0) this->options.batchesPerTurn = 1;
+    for (auto &count : waiting) count = 0;
+}
+
+OPCDeliveryChannel::~OPCDeliveryChannel() {
+    {
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idleCv.wait(lock, [this] { return lanesScheduled == 0; });
+    }
+    pool.shutdown();
+}
+
+std::shared_ptr<OPCDeliveryChannel::lane> OPCDeliveryChannel::laneOf(uint32_t groupId) {
+    std::lock_guard<std::mutex> lock(lanesMutex);
+    auto &entry = lanes[groupId];
+    if (!entry) {
+        entry = std::make_shared<lane>();
+        entry->groupId = groupId;
+    }
+    return entry;
+}
+
+// writes the values into the slots of their items: a value not yet delivered is replaced
+void OPCDeliveryChannel::coalesce(lane &current, easyopcda::opcGroupBatch &batch) {
+    if (current.dirty.empty()) current.dirtySince = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < batch.values.size(); i++) {
+        OPCHANDLE handle = batch.clientHandles[i];
+        if (handle >= current.slots.size()) current.slots.resize(handle + 1);
+        coalescedSlot &slot = current.slots[handle];
+        if (slot.dirty) {
+            current.stats.valuesCoalesced++;
+            valuesCoalesced++;
+        } else {
+            slot.dirty = true;
+            current.dirty.push_back(handle);
+            current.stats.valuesQueued++;
+        }
+        slot.value = std::move(batch.values[i]);
+    }
+}
+
+// applies the overflow policy before count values are queued, with the lane locked. false: the new batch is dropped
+bool OPCDeliveryChannel::makeRoom(lane &current, size_t count, std::unique_lock<std::mutex> &lock) {
+    size_t limit = current.overflow.maxQueuedValues;
+    auto full = [&current, count, limit] { return limit > 0 && current.stats.valuesQueued > 0 && current.stats.valuesQueued + count > limit; };
+    if (!full()) return true;
+
+    switch (current.overflow.policy) {
+        case easyopcda::opcOverflowPolicy::block: {
+            auto start = std::chrono::steady_clock::now();
+            current.stats.callbacksBlocked++;
+            // the policy may change while waiting
+            current.space.wait(lock, [&current, &full] { return !full() || current.overflow.policy != easyopcda::opcOverflowPolicy::block; });
+            current.stats.blockedMs += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            return full() ? makeRoom(current, count, lock) : true;
+        }
+        case easyopcda::opcOverflowPolicy::dropOldest:
+            while (full() && !current.batches.empty()) {
+                size_t dropped = current.batches.front().second.values.size();
+                current.batches.pop_front();
+                current.stats.valuesQueued -= dropped;
+                current.stats.valuesDropped += dropped;
+                valuesDropped += dropped;
+                {
+                    std::lock_guard<std::mutex> statsLock(statsMutex);
+                    priorityStats[current.level].batchesQueued--;
+                }
+                batchesQueued--;
+            }
+            return true;
+        case easyopcda::opcOverflowPolicy::dropNewest:
+            current.stats.valuesDropped += count;
+            valuesDropped += count;
+            return false;
+        default:
+            return true;
+    }
+}
+
+void OPCDeliveryChannel::push(easyopcda::opcGroupBatch &&batch) {
+    // the lane is kept by this call even if its group is removed while blocked
+    std::shared_ptr<lane> current = laneOf(batch.groupId);
+    {
+        std::unique_lock<std::mutex> lock(current->mutex);
+        // a lane created by setOverflow takes the priority of its first batch
+        if (!current->scheduled) {
+            current->priority = batch.priority;
+            current->level = std::min(easyopcda::priorityLevel(batch.priority), easyopcda::priorityLevels - 1);
+        }
+
+        if (current->overflow.policy == easyopcda::opcOverflowPolicy::coalesce && batch.clientHandles.size() == batch.values.size()) {
+            coalesce(*current, batch);
+        } else {
+            size_t count = batch.values.size();
+            if (!makeRoom(*current, count, lock)) return;
+            current->stats.valuesQueued += count;
+            {
+                std::lock_guard<std::mutex> statsLock(statsMutex);
+                priorityStats[current->level].batchesQueued++;
+            }
+            current->batches.emplace_back(std::chrono::steady_clock::now(), std::move(batch));
+            size_t total = ++batchesQueued;
+            size_t max = maxBatchesQueued;
+            while (total > max && !maxBatchesQueued.compare_exchange_weak(max, total));
+        }
+
+        if (current->scheduled || current->empty()) return;
+        current->scheduled = true;
+    }
+    lanesScheduled++;
+    post(current);
+}
+
+void OPCDeliveryChannel::removeGroup(uint32_t groupId) {
+    std::lock_guard<std::mutex> lock(lanesMutex);
+    lanes.erase(groupId);
+}
+
+void OPCDeliveryChannel::setOverflow(uint32_t groupId, const easyopcda::opcOverflowOptions &options) {
+    std::shared_ptr<lane> current = laneOf(groupId);
+    {
+        std::lock_guard<std::mutex> lock(current->mutex);
+        current->overflow = options;
+    }
+    current->space.notify_all();
+}
+
+bool OPCDeliveryChannel::getOverflowStats(uint32_t groupId, easyopcda::opcOverflowStats &stats) {
+    std::shared_ptr<lane> current;
+    {
+        std::lock_guard<std::mutex> lock(lanesMutex);
+        auto it = lanes.find(groupId);
+        if (it == lanes.end()) return false;
+        current = it->second;
+    }
+    std::lock_guard<std::mutex> lock(current->mutex);
+    stats = current->stats;
+    return true;
+}
+
+// queues a scheduled lane on the pool, as the task of its next turn
+void OPCDeliveryChannel::post(const std::shared_ptr<lane> &current) {
+    waiting[current->level]++;
+    pool.post([this, current] { runTurn(current); });
+}
+
+bool OPCDeliveryChannel::higherWaiting(size_t level) const {
+    for (size_t higher = 0; higher < level; higher++) {
+        if (waiting[higher] > 0) return true;
+    }
+    return false;
+}
+
+// strict policy: posts again the parked lanes with no higher priority waiting. called after every turn
+void OPCDeliveryChannel::unparkReady() {
+    std::vector<std::shared_ptr<lane>> ready;
+    {
+        std::lock_guard<std::mutex> lock(parkedMutex);
+        for (size_t level = 0; level < parked.size(); level++) {
+            if (higherWaiting(level)) break;
+            for (auto &current : parked[level]) ready.push_back(std::move(current));
+            parked[level].clear();
+        }
+    }
+    // still counted as waiting while parked
+    for (auto &current : ready) {
+        pool.post([this, current] { runTurn(current); });
+    }
+}
+
+// one turn of the lane: the coalesced values as one batch, then the queued batches of the turn, called back
+// outside the lock. the lane is run by one task at a time
+void OPCDeliveryChannel::runTurn(const std::shared_ptr<lane> &current) {
+    size_t level = current->level;
+    if (options.policy == easyopcda::opcPriorityPolicy::strict) {
+        std::lock_guard<std::mutex> lock(parkedMutex);
+        // checked under parkedMutex: a higher lane unparks after its turn, so it finds this one parked
+        if (higherWaiting(level)) {
+            parked[level].push_back(current);
+            return;
+        }
+    }
+    waiting[level]--;
+
+    std::vector<easyopcda::opcGroupBatch> turn;
+    {
+        std::lock_guard<std::mutex> lock(current->mutex);
+        std::vector<std::chrono::steady_clock::time_point> queued;
+
+        if (!current->dirty.empty()) {
+            easyopcda::opcGroupBatch batch = {current->groupId, current->priority, {}, {}};
+            batch.values.reserve(current->dirty.size());
+            batch.clientHandles.reserve(current->dirty.size());
+            for (OPCHANDLE handle : current->dirty) {
+                coalescedSlot &slot = current->slots[handle];
+                batch.values.push_back(std::move(slot.value));
+                batch.clientHandles.push_back(handle);
+                slot.dirty = false;
+            }
+            current->stats.valuesQueued -= current->dirty.size();
+            current->dirty.clear();
+            queued.push_back(current->dirtySince);
+            turn.push_back(std::move(batch));
+        }
+
+        size_t perTurn = options.batchesPerTurn;
+        if (options.policy == easyopcda::opcPriorityPolicy::weighted) perTurn *= priorityWeights[level];
+        size_t count = std::min(perTurn, current->batches.size());
+        for (size_t i = 0; i < count; i++) {
+            queued.push_back(current->batches.front().first);
+            batchesQueued--;
+            current->stats.valuesQueued -= current->batches.front().second.values.size();
+            turn.push_back(std::move(current->batches.front().second));
+            current->batches.pop_front();
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        std::lock_guard<std::mutex> statsLock(statsMutex);
+        easyopcda::opcPriorityStats &stats = priorityStats[level];
+        stats.batchesQueued -= count;
+        for (auto &time : queued) {
+            double wait = std::chrono::duration<double, std::milli>(now - time).count();
+            stats.averageWaitMs = (stats.batchesDelivered == 0) ? wait : 0.8 * stats.averageWaitMs + 0.2 * wait;
+            stats.maxWaitMs = std::max(stats.maxWaitMs, wait);
+            stats.batchesDelivered++;
+        }
+    }
+    current->space.notify_all();
+
+    for (auto &batch : turn) {
+        callback(batch);
+        batchesDelivered++;
+        valuesDelivered += batch.values.size();
+    }
+
+    bool idle;
+    {
+        std::lock_guard<std::mutex> lock(current->mutex);
+        idle = current->empty();
+        if (idle) current->scheduled = false;
+    }
+    // still scheduled: no other task runs the lane meanwhile
+    if (!idle) post(current);
+    if (options.policy == easyopcda::opcPriorityPolicy::strict) unparkReady();
+    if (idle && --lanesScheduled == 0) {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        idleCv.notify_all();
+    }
+}
+
+easyopcda::opcChannelStats OPCDeliveryChannel::getStats() {
+    std::lock_guard<std::mutex> lock(statsMutex);
+    return {batchesDelivered.load(), valuesDelivered.load(), batchesQueued.load(), maxBatchesQueued.load(), pool.stealCount(),
+            priorityStats, valuesDropped.load(), valuesCoalesced.load()};
+}
@@ -0,0 +1,111 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcdiscoverycache.h"
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+
+
+static long long secondsSinceEpoch() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+OPCDiscoveryCache::OPCDiscoveryCache(std::wstring path, DWORD ttlSeconds) : path(std::move(path)), ttlSeconds(ttlSeconds) {
+    load();
+}
+
+// one entry per line: host, progID, CLSID and scan time separated by tabs, in UTF-8
+void OPCDiscoveryCache::load() {
+    std::ifstream file{std::filesystem::path(path)};
+    if (!file) {
+        INFO_LOG("Discovery cache {} not found. Starting empty", wstringToUTF8(path));
+        return;
+    }
+
+    long long now = secondsSinceEpoch();
+    size_t loaded = 0;
+    std::string line;
+    while (std::getline(file, line)) {
+        std::vector<std::string> fields;
+        size_t start = 0;
+        for (size_t tab = line.find('\t'); tab != std::string::npos; tab = line.find('\t', start)) {
+            fields.push_back(line.substr(start, tab - start));
+            start = tab + 1;
+        }
+        fields.push_back(line.substr(start));
+        if (fields.size() != 4) continue;
+
+        cacheEntry entry;
+        if (!stringToGUID(utf8ToWstring(fields[2]), entry.clsid)) continue;
+        entry.scannedAt = std::atoll(fields[3].c_str());
+        if (now - entry.scannedAt > ttlSeconds) continue;
+        entries[std::make_pair(utf8ToWstring(fields[0]), utf8ToWstring(fields[1]))] = entry;
+        loaded++;
+    }
+    INFO_LOG("Discovery cache {}: {} servers loaded", wstringToUTF8(path), loaded);
+}
+
+// written to a temporary file first, so that a crash never leaves a truncated cache
+void OPCDiscoveryCache::save() {
+    std::filesystem::path target(path);
+    std::filesystem::path temporary(path + L".tmp");
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        if (!file) {
+            ERROR_LOG("Discovery cache {} could not be written", wstringToUTF8(path));
+            return;
+        }
+        for (auto &it : entries) {
+            file << wstringToUTF8(it.first.first) << '\t' << wstringToUTF8(it.first.second) << '\t'
+                 << GUIDToUTF8(it.second.clsid) << '\t' << it.second.scannedAt << '\n';
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temporary, target, ec);
+    if (ec) {
+        ERROR_LOG("Discovery cache {} could not be replaced: {}", wstringToUTF8(path), ec.message());
+    }
+}
+
+bool OPCDiscoveryCache::lookup(const std::wstring &host, const std::wstring &progID, CLSID &clsid) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = entries.find(std::make_pair(host, progID));
+    if (it == entries.end()) return false;
+    if (secondsSinceEpoch() - it->second.scannedAt > ttlSeconds) {
+        entries.erase(it);
+        return false;
+    }
+    clsid = it->second.clsid;
+    return true;
+}
+
+void OPCDiscoveryCache::storeHost(const std::wstring &host, const std::vector<easyopcda::opcDiscoveredServer> &servers) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (auto it = entries.begin(); it != entries.end();) {
+        if (it->first.first == host) it = entries.erase(it);
+        else ++it;
+    }
+    long long now = secondsSinceEpoch();
+    for (auto &server : servers) {
+        entries[std::make_pair(host, server.progID)] = {server.clsid, now};
+    }
+    save();
+}
@@ -0,0 +1,181 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcexecutor.h"
+
+#include <algorithm>
+#include <utility>
+
+
+OPCExecutor::OPCExecutor(std::string name, size_t threads) : name(std::move(name)) {
+    busy = 0;
+    running = true;
+    parent = nullptr;
+    laneThreads = 0;
+    laneRunning = 0;
+    if (threads == 0) threads = 1;
+    workers.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        workers.emplace_back(&OPCExecutor::worker, this, i);
+    }
+    DEBUG_LOG("Executor {} started {} threads", this->name, threads);
+}
+
+OPCExecutor::OPCExecutor(std::string name, OPCExecutor &parent, size_t threads) : name(std::move(name)) {
+    busy = 0;
+    running = true;
+    this->parent = &parent;
+    laneThreads = threads ? threads : 1;
+    laneRunning = 0;
+    DEBUG_LOG("Executor {} runs up to {} tasks on executor {}", this->name, laneThreads, parent.name);
+}
+
+OPCExecutor::~OPCExecutor() {
+    shutdown();
+}
+
+bool OPCExecutor::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) return false;
+        tasks.push_back(std::move(task));
+        if (parent && laneRunning < laneThreads) {
+            laneRunning++;
+            if (!parent->post([this] { runLane(); })) {
+                // tasks are left to the runLane calls still queued, if any
+                if (--laneRunning == 0) {
+                    tasks.pop_back();
+                    idleCv.notify_all();
+                    return false;
+                }
+            }
+        }
+    }
+    cv.notify_one();
+    return true;
+}
+
+// runs one task of the lane, then queues the lane again behind the other tasks of the parent. once the parent
+// refuses tasks the remaining ones run here
+void OPCExecutor::runLane() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!tasks.empty()) {
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        busy++;
+        lock.unlock();
+        task();
+        task = nullptr;
+        lock.lock();
+        busy--;
+        if (tasks.empty()) break;
+        if (parent->post([this] { runLane(); })) return;
+    }
+    laneRunning--;
+    idleCv.notify_all();
+}
+
+// tasks of one runAll, taken by the caller and by the workers helping it
+struct executorBatch {
+    std::mutex mutex;
+    std::condition_variable done;
+    std::deque<std::function<void()>> tasks;
+    size_t unfinished = 0;
+};
+
+static void runBatch(const std::shared_ptr<executorBatch> &batch) {
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    while (!batch->tasks.empty()) {
+        std::function<void()> task = std::move(batch->tasks.front());
+        batch->tasks.pop_front();
+        lock.unlock();
+        task();
+        task = nullptr;
+        lock.lock();
+        if (--batch->unfinished == 0) batch->done.notify_all();
+    }
+}
+
+void OPCExecutor::runAll(std::vector<std::function<void()>> &batch, size_t parallelism) {
+    if (batch.empty()) return;
+    auto shared = std::make_shared<executorBatch>();
+    shared->unfinished = batch.size();
+    for (auto &task : batch) shared->tasks.push_back(std::move(task));
+    batch.clear();
+
+    // helpers starting after the tasks were taken return at once
+    size_t helpers = std::min(std::max<size_t>(1, parallelism), shared->unfinished) - 1;
+    for (size_t i = 0; i < helpers; i++) {
+        if (!post([shared] { runBatch(shared); })) break;
+    }
+    runBatch(shared);
+
+    std::unique_lock<std::mutex> lock(shared->mutex);
+    shared->done.wait(lock, [&shared] { return shared->unfinished == 0; });
+}
+
+void OPCExecutor::drain() {
+    std::unique_lock<std::mutex> lock(mutex);
+    idleCv.wait(lock, [this] { return tasks.empty() && busy == 0 && laneRunning == 0; });
+}
+
+void OPCExecutor::shutdown() {
+    if (parent) {
+        std::unique_lock<std::mutex> lock(mutex);
+        running = false;
+        idleCv.wait(lock, [this] { return laneRunning == 0; });
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running && workers.empty()) return;
+        running = false;
+    }
+    cv.notify_all();
+    for (auto &w : workers) {
+        if (w.joinable()) w.join();
+    }
+    workers.clear();
+}
+
+void OPCExecutor::worker(size_t index) {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on executor {} thread {}. Error code = {}", name, index, hresultToUTF8(hrInit));
+    }
+
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread {} running executor {}", hid, name);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cv.wait(lock, [this] { return !running || !tasks.empty(); });
+        if (tasks.empty()) break;
+        std::function<void()> task = std::move(tasks.front());
+        tasks.pop_front();
+        busy++;
+        lock.unlock();
+        task();
+        task = nullptr;
+        lock.lock();
+        if (--busy == 0 && tasks.empty()) idleCv.notify_all();
+    }
+    lock.unlock();
+
+    if SUCCEEDED(hrInit) CoUninitialize();
+}
@@ -21,366 +21,477 @@
 
 #include"spdlog/spdlog.h"
 
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <memory>
 #include <string>
 #include <utility>
 
-OPCGroup::OPCGroup(std::wstring name, CComPtr<IOPCServer> &pOPCServer, COAUTHIDENTITY *pAuthIdent, DWORD reqUpdRate, easyopcda::ASyncCallback func)
+OPCGroup::OPCGroup(std::wstring name, CComPtr<IOPCServer> &pOPCServer, COAUTHIDENTITY *pAuthIdent, DWORD reqUpdRate, easyopcda::ASyncCallback func,
+                   OPCExecutor *executor, OPCTimer *timer)
 //: ss_sink(std::make_shared<spdlog::sinks::ostream_sink_mt>(ss)),
 //  logger(std::make_shared<spdlog::logger>("easyopcda", ss_sink))
 {
-    error = false;
-    myOPCServer = pOPCServer.p;
+    state = easyopcda::opcGroupState::creating;
+    callbacksInFlight = 0;
+    shutdownDone = false;
+    shutdownReport = {false, 0, 0, 0, 0};
+    connectionLost = false;
+    autoReadEnabled = false;
+    requestedUpdateRate = reqUpdRate;
 
     myName = std::move(name);
 
     externalAsyncCallback = std::move(func);
+    groupId = 0;
+    priority = easyopcda::opcPriority::normal;
 
-    ReferencesCount = 0;
+    // the reference of the creator
+    ReferencesCount = 1;
+    this->executor = executor;
+    this->timer = timer;
 
     lastClientItemHandle = 0;
+    currentItems = std::make_shared<itemTable>();
+    itemCount = 0;
+    activeItemsVersion = 0;
+
+    writeQueueRunning = false;
+    writeQueueFlushing = false;
+    writeQueueAwaiting = false;
+    writeQueueWindow = 0;
+    writeQueueMaxItems = 0;
+
+    transactionTimeout = 30000;
+    maxReadsInFlight = 0;
+    blockOnReadWindowFull = true;
+    readsInFlight = 0;
+    readWindow = 0;
+    readWindowCredit = 0;
+    readLatencyMin = 0;
+    readLatencyAverage = 0;
+    readsRejected = 0;
+    transactionsIssued = 0;
+    transactionsCompleted = 0;
+    transactionsCancelled = 0;
+    transactionsTimedOut = 0;
+
+    authIdent = pAuthIdent;
+    realUpdateRate = 0;
+    interfaces = std::make_shared<groupInterfaces>();
+    if SUCCEEDED(attachToServer(pOPCServer)) changeState({easyopcda::opcGroupState::creating}, easyopcda::opcGroupState::inactive);
+    else changeState({easyopcda::opcGroupState::creating}, easyopcda::opcGroupState::closed);
+}
+
+// run by the constructor and by reconnect. the interfaces of the lost server are released by the last call
+// still using them
+HRESULT OPCGroup::attachToServer(CComPtr<IOPCServer> &server) {
+    auto next = std::make_shared<groupInterfaces>();
+    next->server = server;
+    HRESULT hr = createGroup(*next);
+    std::atomic_store(&interfaces, next);
+    return hr;
+}
 
-    lastClientTransactionID = 0;
+// calls a group creation makes on a DCOM proxy: AddGroup, QueryMultipleInterfaces, and FindConnectionPoint and
+// Advise for each of the two sinks. more means the interfaces were queried one by one
+static const DWORD groupCreationRoundTrips = 6;
 
+// creates the group on itf.server and acquires its interfaces into itf
+HRESULT OPCGroup::createGroup(groupInterfaces &itf) {
     HRESULT hr;
     OPCHANDLE clientHandle = 0;
     DWORD lcid = 0x409; // Code 0x409 = ENGLISH
 
-    if (pOPCServer == nullptr) {
-        error = true;
+    if (itf.server == nullptr) {
         ERROR_LOG("invalid OPC server");
-        return;
+        return E_POINTER;
     }
 
-    groupMgr = nullptr;
-    itemMgr = nullptr;
-    syncIO = nullptr;
-    syncIO2 = nullptr;
-    asyncIO = nullptr;
-    asyncIO2 = nullptr;
-    asyncIO3 = nullptr;
-    connectionPointContainer = nullptr;
-    asyncDataCallbackConnectionPoint = nullptr;
-    asyncCallbackHandle = 0;
-    shutdownConnectionPoint = nullptr;
-    shutdownHandle = 0;
-
-    thisGroupHandle = NULL;
     realUpdateRate = 0;
 
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread building OPC group: {}", hid);
 
-    hr = pOPCServer->AddGroup(myName.c_str(), //	una stringa con il nome del gruppo?
-                              FALSE, //	attivo o no??
-                              reqUpdRate, //	update rate richiesto
-                              clientHandle, //	handle richiesto
-                              nullptr, //	fuso orario?
-                              nullptr, //	banda morta?
-                              lcid, //	lingua
-                              &thisGroupHandle, //	restituisce l'handle vero
-                              &realUpdateRate, //	update rate vero
-                              IID_IOPCGroupStateMgt, //	quale interfaccia vuoi?
-                              (LPUNKNOWN *) &groupMgr); //	puntatore dove mettere interfaccia
+    hr = itf.server->AddGroup(myName.c_str(), //	una stringa con il nome del gruppo?
+                             FALSE, //	attivo o no??
+                             requestedUpdateRate, //	update rate richiesto
+                             clientHandle, //	handle richiesto
+                             nullptr, //	fuso orario?
+                             nullptr, //	banda morta?
+                             lcid, //	lingua
+                             &itf.groupHandle, //	restituisce l'handle vero
+                             &realUpdateRate, //	update rate vero
+                             IID_IOPCGroupStateMgt, //	quale interfaccia vuoi?
+                             (LPUNKNOWN *) &itf.groupMgr); //	puntatore dove mettere interfaccia
     if (FAILED(hr)) {
-        groupMgr = nullptr;
-        error = true;
+        itf.groupMgr = nullptr;
         ERROR_LOG("function AddGroup of OPCServer instance failed. Error: {}", hresultToUTF8(hr));
-        return;
+        return hr;
+    }
+    itf.roundTrips++;
+    setProxyBlanket(itf.groupMgr, "IOPCGroupStateMgt");
+
+    // the interfaces used by every group are acquired in a single call. IOPCSyncIO is only needed by servers
+    // without IOPCSyncIO2 and is acquired on first use
+    MULTI_QI qiList[5] = {
+        {&IID_IOPCItemMgt, nullptr, S_OK},
+        {&IID_IOPCSyncIO2, nullptr, S_OK},
+        {&IID_IOPCAsyncIO2, nullptr, S_OK},
+        {&IID_IOPCAsyncIO3, nullptr, S_OK},
+        {&IID_IConnectionPointContainer, nullptr, S_OK}
+    };
+    queryGroupInterfaces(itf, qiList, 5);
+    if SUCCEEDED(qiList[0].hr) itf.itemMgr.Attach(reinterpret_cast<IOPCItemMgt *>(qiList[0].pItf));
+    if SUCCEEDED(qiList[1].hr) itf.syncIO2.Attach(reinterpret_cast<IOPCSyncIO2 *>(qiList[1].pItf));
+    if SUCCEEDED(qiList[2].hr) itf.asyncIO2.Attach(reinterpret_cast<IOPCAsyncIO2 *>(qiList[2].pItf));
+    if SUCCEEDED(qiList[3].hr) itf.asyncIO3.Attach(reinterpret_cast<IOPCAsyncIO3 *>(qiList[3].pItf));
+    if SUCCEEDED(qiList[4].hr) itf.connectionPointContainer.Attach(reinterpret_cast<IConnectionPointContainer *>(qiList[4].pItf));
+
+    if (!itf.itemMgr) {
+        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCItemMgt. Error: {}", hresultToUTF8(qiList[0].hr));
+        return FAILED(qiList[0].hr) ? qiList[0].hr : E_NOINTERFACE;
+    }
+    setProxyBlanket(itf.itemMgr, "IOPCItemMgt");
+
+    if (itf.syncIO2) {
+        setProxyBlanket(itf.syncIO2, "IOPCSyncIO2");
+    } else {
+        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCSyncIO2. Error: {}", hresultToUTF8(qiList[1].hr));
+    }
+
+    bool daSpec20 = false;
+    bool daSpec30 = false;
+
+    if (itf.asyncIO2) {
+        daSpec20 = true;
+        setProxyBlanket(itf.asyncIO2, "IOPCAsyncIO2");
+    } else {
+        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCAsyncIO2. Error: {}", hresultToUTF8(qiList[2].hr));
+    }
+
+    if (itf.asyncIO3) {
+        daSpec30 = true;
+        setProxyBlanket(itf.asyncIO3, "IOPCAsyncIO3");
+    } else {
+        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCAsyncIO3. Error: {}", hresultToUTF8(qiList[3].hr));
+    }
+
+    if ((daSpec20 || daSpec30) && itf.connectionPointContainer) {
+        HRESULT result;
+        setProxyBlanket(itf.connectionPointContainer, "IConnectionPointContainer");
+
+        itf.roundTrips++;
+        result = itf.connectionPointContainer->FindConnectionPoint(IID_IOPCDataCallback,&itf.asyncDataCallbackConnectionPoint);
+        if (SUCCEEDED(result)) {
+            setProxyBlanket(itf.asyncDataCallbackConnectionPoint, "IConnectionPoint");
+
+            itf.roundTrips++;
+            result = itf.asyncDataCallbackConnectionPoint->Advise((IUnknown *) ((IOPCDataCallback *) this),&itf.asyncCallbackHandle);
+            if (FAILED(result)) {
+                if(itf.asyncIO2) {
+                    itf.asyncIO2.Release();
+                    itf.asyncIO2 = nullptr;
+                }
+                if(itf.asyncIO3) {
+                    itf.asyncIO3.Release();
+                    itf.asyncIO3 = nullptr;
+                }
+                itf.asyncDataCallbackConnectionPoint = nullptr;
+                itf.asyncCallbackHandle = 0;
+                ERROR_LOG("Failed to retrieve handle of IOPCDataCallback from class IID_IOPCDataCallback. Cannot implement async read/write connection. Error: {}", hresultToUTF8(result));
+            }
+        } else {
+            if(itf.asyncIO2) {
+                itf.asyncIO2.Release();
+                itf.asyncIO2 = nullptr;
+            }
+            if(itf.asyncIO3) {
+                itf.asyncIO3.Release();
+                itf.asyncIO3 = nullptr;
+            }
+            itf.asyncDataCallbackConnectionPoint = nullptr;
+            itf.asyncCallbackHandle = 0;
+            ERROR_LOG("Failed to retrieve interface pointer IID_IOPCDataCallback from class IID_IConnectionPointContainer. Cannot implement async read/write connection. Error: {}", hresultToUTF8(result));
+        }
+
+        itf.roundTrips++;
+        result = itf.connectionPointContainer->FindConnectionPoint(IID_IOPCShutdown, &itf.shutdownConnectionPoint);
+        if (SUCCEEDED(result)) {
+            setProxyBlanket(itf.shutdownConnectionPoint, "IConnectionPoint");
+
+            itf.roundTrips++;
+            result = itf.shutdownConnectionPoint->Advise((IUnknown *) ((IOPCShutdown *) this), &itf.shutdownHandle);
+            if (FAILED(result)) {
+                itf.shutdownConnectionPoint = nullptr;
+                itf.shutdownHandle = 0;
+                ERROR_LOG("Failed to retrieve handle of IOPCShutdown from class IID_IOPCShutdown. Cannot implement async shutdown connection. Error: {}",hresultToUTF8(result));
+            }
+        } else {
+            itf.asyncDataCallbackConnectionPoint = nullptr;
+            itf.shutdownConnectionPoint = nullptr;
+            ERROR_LOG("Failed to retrieve interface pointer IID_IOPCShutdown from class IID_IConnectionPointContainer. Cannot implement async shutdown connection. Error: {}", hresultToUTF8(result));
+        }
     }
+
+    INFO_LOG("Group {} created with {} round trips to the server", wstringToUTF8(myName), itf.roundTrips);
+    if (itf.roundTrips > groupCreationRoundTrips) {
+        WARN_LOG("Group {} needed {} round trips, at most {} expected: the server did not resolve the interfaces in one call",
+                 wstringToUTF8(myName), itf.roundTrips, groupCreationRoundTrips);
+    }
+    return S_OK;
+}
+
+
+void OPCGroup::setProxyBlanket(IUnknown *proxy, const char *interfaceName) {
     HRESULT hrAuth = CoSetProxyBlanket(
-        groupMgr, // the proxy to set
+        proxy, // the proxy to set
         RPC_C_AUTHN_WINNT, // authentication service
         RPC_C_AUTHZ_NONE, // authorization service
         NULL, // server principal name
         RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
         RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-        pAuthIdent, // authentication information
+        authIdent, // authentication information
         EOAC_NONE // additional capabilities
     );
     if (FAILED(hrAuth)) {
-        ERROR_LOG("CoSetProxyBlanket failed on the IOPCGroupStateMgt with error ", hresultToUTF8(hrAuth));
-        //return;
+        ERROR_LOG("CoSetProxyBlanket failed on the {} with error: {}", interfaceName, hresultToUTF8(hrAuth));
     }
+}
 
-
-    hr = groupMgr->QueryInterface(IID_IOPCItemMgt, (void **) &itemMgr);
-    if (FAILED(hr)) {
-        itemMgr = nullptr;
-        error = true;
-        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCItemMgt. Error: {}", hresultToUTF8(hr));
-        return;
-    } else {
-        HRESULT hrAuth = CoSetProxyBlanket(
-            itemMgr, // the proxy to set
-            RPC_C_AUTHN_WINNT, // authentication service
-            RPC_C_AUTHZ_NONE, // authorization service
-            NULL, // server principal name
-            RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-            RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-            pAuthIdent, // authentication information
-            EOAC_NONE // additional capabilities
-        );
-        if (FAILED(hrAuth)) {
-            ERROR_LOG("CoSetProxyBlanket failed on the IOPCItemMgt with error: {}", hresultToUTF8(hrAuth));
-        }
-    }
-
-    hr = groupMgr->QueryInterface(IID_IOPCSyncIO, (void **) &syncIO);
-    if (FAILED(hr)) {
-        syncIO = nullptr;
-        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCSyncIO. Error: {}", hresultToUTF8(hr));
-    } else {
-        HRESULT hrAuth = CoSetProxyBlanket(
-            syncIO, // the proxy to set
-            RPC_C_AUTHN_WINNT, // authentication service
-            RPC_C_AUTHZ_NONE, // authorization service
-            NULL, // server principal name
-            RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-            RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-            pAuthIdent, // authentication information
-            EOAC_NONE // additional capabilities
-        );
-        if (FAILED(hrAuth)) {
-            ERROR_LOG("CoSetProxyBlanket failed on the IOPCSyncIO with error: {}", hresultToUTF8(hrAuth));
+// on a DCOM proxy IMultiQI is implemented locally by the proxy manager, and QueryMultipleInterfaces
+// resolves all the interfaces in one round trip. in-process objects get one QueryInterface each
+void OPCGroup::queryGroupInterfaces(groupInterfaces &itf, MULTI_QI *qiList, ULONG count) {
+    ATL::CComPtr<IMultiQI> multiQI;
+    HRESULT hr = itf.groupMgr->QueryInterface(IID_IMultiQI, (void **) &multiQI);
+    if SUCCEEDED(hr) {
+        itf.roundTrips++;
+        hr = multiQI->QueryMultipleInterfaces(count, qiList);
+        if SUCCEEDED(hr) return;
+        ERROR_LOG("QueryMultipleInterfaces on instance of IID_IOPCGroupStateMgt failed. Error: {}", hresultToUTF8(hr));
+        for (ULONG i = 0; i < count; i++) {
+            if (SUCCEEDED(qiList[i].hr) && qiList[i].pItf) qiList[i].pItf->Release();
         }
     }
 
+    for (ULONG i = 0; i < count; i++) {
+        itf.roundTrips++;
+        qiList[i].pItf = nullptr;
+        qiList[i].hr = itf.groupMgr->QueryInterface(*qiList[i].pIID, (void **) &qiList[i].pItf);
+    }
+}
 
-    hr = groupMgr->QueryInterface(IID_IOPCSyncIO2, (void **) &syncIO2);
-    if (FAILED(hr)) {
-        syncIO2 = nullptr;
-        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCSyncIO2. Error: {}", hresultToUTF8(hr));
-    } else {
-        HRESULT hrAuth = CoSetProxyBlanket(
-            syncIO2, // the proxy to set
-            RPC_C_AUTHN_WINNT, // authentication service
-            RPC_C_AUTHZ_NONE, // authorization service
-            NULL, // server principal name
-            RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-            RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-            pAuthIdent, // authentication information
-            EOAC_NONE // additional capabilities
-        );
-        if (FAILED(hrAuth)) {
-            ERROR_LOG("CoSetProxyBlanket failed on the IOPCSyncIO2 with error: {}", hresultToUTF8(hrAuth));
-        }
-    }
-
-    bool daSpec10 = false;
-    bool daSpec20 = false;
-    bool daSpec30 = false;
-
-    HRESULT hr1 = groupMgr->QueryInterface(IID_IOPCAsyncIO, (void **) &asyncIO);
-    if SUCCEEDED(hr1) {
-        daSpec10 = true;
-
-        HRESULT hrAuth = CoSetProxyBlanket(
-            asyncIO, // the proxy to set
-            RPC_C_AUTHN_WINNT, // authentication service
-            RPC_C_AUTHZ_NONE, // authorization service
-            NULL, // server principal name
-            RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-            RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-            pAuthIdent, // authentication information
-            EOAC_NONE // additional capabilities
-        );
-        if (FAILED(hrAuth)) {
-            ERROR_LOG("CoSetProxyBlanket failed on the IOPCAsyncIO with error: {}", hresultToUTF8(hrAuth));
+// valid while itf is held
+IOPCSyncIO *OPCGroup::getSyncIO(groupInterfaces &itf) {
+    if (itf.syncIO2) return itf.syncIO2;
+
+    std::lock_guard<std::mutex> lock(itf.syncIOMutex);
+    if (!itf.syncIOQueried && itf.groupMgr) {
+        itf.syncIOQueried = true;
+        HRESULT hr = itf.groupMgr->QueryInterface(IID_IOPCSyncIO, (void **) &itf.syncIO);
+        if (FAILED(hr)) {
+            itf.syncIO = nullptr;
+            ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCSyncIO. Error: {}", hresultToUTF8(hr));
+        } else {
+            setProxyBlanket(itf.syncIO, "IOPCSyncIO");
         }
-    } else {
-        asyncIO = nullptr;
-        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCAsyncIO. Error: {}", hresultToUTF8(hr1));
     }
+    return itf.syncIO;
+}
 
-    HRESULT hr2 = groupMgr->QueryInterface(IID_IOPCAsyncIO2, (void **) &asyncIO2);
-    if SUCCEEDED(hr2) {
-        daSpec20 = true;
-
-        HRESULT hrAuth = CoSetProxyBlanket(
-            asyncIO2, // the proxy to set
-            RPC_C_AUTHN_WINNT, // authentication service
-            RPC_C_AUTHZ_NONE, // authorization service
-            NULL, // server principal name
-            RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-            RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-            pAuthIdent, // authentication information
-            EOAC_NONE // additional capabilities
-        );
-        if (FAILED(hrAuth)) {
-            ERROR_LOG("CoSetProxyBlanket failed on the IOPCAsyncIO2 with error: {}", hresultToUTF8(hrAuth));
-        }
-    } else {
-        asyncIO2 = nullptr;
-        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCAsyncIO2. Error: {}", hresultToUTF8(hr2));
+// server calls made by OPCGroup::shutdown. they run on the executor holding their own references to the
+// proxies, so a call still blocked at the deadline is left behind without touching the group
+struct shutdownCallBatch {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<std::function<void()>> calls;
+    size_t unfinished = 0;
+};
+
+static void runShutdownCalls(const std::shared_ptr<shutdownCallBatch> &batch) {
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    while (!batch->calls.empty()) {
+        std::function<void()> call = std::move(batch->calls.front());
+        batch->calls.pop_front();
+        lock.unlock();
+        call();
+        // the proxies held by the call are released on this thread as well
+        call = nullptr;
+        lock.lock();
+        batch->unfinished--;
+        batch->cv.notify_all();
     }
+}
 
-    HRESULT hr3 = groupMgr->QueryInterface(IID_IOPCAsyncIO3, (void **) &asyncIO3);
-    if SUCCEEDED(hr3) {
-        daSpec30 = true;
+// used once the executor refuses tasks
+static void runShutdownCallsOnThread(std::shared_ptr<shutdownCallBatch> batch) {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on group shutdown thread. Error code = {}", hresultToUTF8(hrInit));
+    }
+    runShutdownCalls(batch);
+    if SUCCEEDED(hrInit) CoUninitialize();
+}
 
-        HRESULT hrAuth = CoSetProxyBlanket(
-            asyncIO3, // the proxy to set
-            RPC_C_AUTHN_WINNT, // authentication service
-            RPC_C_AUTHZ_NONE, // authorization service
-            NULL, // server principal name
-            RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-            RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-            pAuthIdent, // authentication information
-            EOAC_NONE // additional capabilities
-        );
-        if (FAILED(hrAuth)) {
-            ERROR_LOG("CoSetProxyBlanket failed on the IOPCAsyncIO3 with error: {}", hresultToUTF8(hrAuth));
-        }
-    } else {
-        asyncIO3 = nullptr;
-        ERROR_LOG("QueryInterFace on instance of IID_IOPCGroupStateMgt could not retrieve instance of IID_IOPCAsyncIO3. Error: {}", hresultToUTF8(hr3));
+// runs the calls on up to parallelism workers of the executor and returns how many did not finish before the deadline
+size_t OPCGroup::shutdownCalls(std::vector<std::function<void()>> &calls, size_t parallelism, std::chrono::steady_clock::time_point deadline) {
+    if (calls.empty()) return 0;
+    auto batch = std::make_shared<shutdownCallBatch>();
+    batch->unfinished = calls.size();
+    for (auto &call : calls) batch->calls.push_back(std::move(call));
+    calls.clear();
+
+    size_t runners = std::max<size_t>(1, std::min(parallelism, batch->unfinished));
+    for (size_t i = 0; i < runners; i++) {
+        if (executor && executor->post([batch] { runShutdownCalls(batch); })) continue;
+        std::thread(runShutdownCallsOnThread, batch).detach();
     }
 
-    if (daSpec20 || daSpec30) {
-        HRESULT result = groupMgr->QueryInterface(IID_IConnectionPointContainer, (void **) &connectionPointContainer);
-        if (SUCCEEDED(result)) {
-            HRESULT hrAuth = CoSetProxyBlanket(
-                connectionPointContainer, // the proxy to set
-                RPC_C_AUTHN_WINNT, // authentication service
-                RPC_C_AUTHZ_NONE, // authorization service
-                NULL, // server principal name
-                RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-                RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-                pAuthIdent, // authentication information
-                EOAC_NONE // additional capabilities
-            );
-            if (FAILED(hrAuth)) {
-                ERROR_LOG("CoSetProxyBlanket failed on the IConnectionPointContainer with error: {}", hresultToUTF8(hrAuth));
-            }
+    std::unique_lock<std::mutex> lock(batch->mutex);
+    batch->cv.wait_until(lock, deadline, [&batch] { return batch->unfinished == 0; });
+    return batch->unfinished;
+}
 
-            result = connectionPointContainer->FindConnectionPoint(IID_IOPCDataCallback,&asyncDataCallbackConnectionPoint);
-            if (SUCCEEDED(result)) {
-                HRESULT hrAuth = CoSetProxyBlanket(
-                    asyncDataCallbackConnectionPoint, // the proxy to set
-                    RPC_C_AUTHN_WINNT, // authentication service
-                    RPC_C_AUTHZ_NONE, // authorization service
-                    NULL, // server principal name
-                    RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-                    RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-                    pAuthIdent, // authentication information
-                    EOAC_NONE // additional capabilities
-                    );
-                if (FAILED(hrAuth)) {
-                    ERROR_LOG("CoSetProxyBlanket failed on the IConnectionPoint with error: {}", hresultToUTF8(hrAuth));
-                }
+// transactions cancelled at the same time by a shutdown
+static const size_t shutdownCancelParallelism = 8;
+static const DWORD defaultShutdownDeadlineMs = 5000;
 
-                result = asyncDataCallbackConnectionPoint->Advise((IUnknown *) ((IOPCDataCallback *) this),&asyncCallbackHandle);
-                if (FAILED(result)) {
-                    if(asyncIO2) {
-                        asyncIO2.Release();
-                        asyncIO2 = nullptr;
-                    }
-                    if(asyncIO3) {
-                        asyncIO3.Release();
-                        asyncIO3 = nullptr;
-                    }
-                    asyncDataCallbackConnectionPoint = nullptr;
-                    asyncCallbackHandle = 0;
-                    ERROR_LOG("Failed to retrieve handle of IOPCDataCallback from class IID_IOPCDataCallback. Cannot implement async read/write connection. Error: {}", hresultToUTF8(result));
-                }
-            } else {
-                if(asyncIO2) {
-                    asyncIO2.Release();
-                    asyncIO2 = nullptr;
+// run by the last Release: no callback is in progress and the server holds no reference any more
+OPCGroup::~OPCGroup() {
+    if (!shutdownDone) shutdown(defaultShutdownDeadlineMs);
+}
+
+easyopcda::opcShutdownReport OPCGroup::shutdown(DWORD deadlineMs) {
+    std::lock_guard<std::mutex> shutdownLock(shutdownMutex);
+    if (shutdownDone) return shutdownReport;
+
+    auto start = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(deadlineMs);
+    shutdownReport = {true, 0, 0, 0, 0};
+
+    disableWriteQueue();
+    // from here requests are refused and data changes dropped
+    state = easyopcda::opcGroupState::closing;
+    // calls still in progress keep the interfaces they loaded
+    std::shared_ptr<groupInterfaces> itf = std::atomic_exchange(&interfaces, std::make_shared<groupInterfaces>());
+
+    // a lost server is not called: every call would wait for the DCOM timeout
+    bool serverCalls = itf->server && !connectionLost;
+    std::vector<std::function<void()>> calls;
+
+    // unadvise first, so that the server stops calling back while the rest is torn down
+    if (serverCalls) {
+        if (itf->asyncDataCallbackConnectionPoint) {
+            ATL::CComPtr<IConnectionPoint> connectionPoint = itf->asyncDataCallbackConnectionPoint;
+            DWORD cookie = itf->asyncCallbackHandle;
+            calls.push_back([connectionPoint, cookie] {
+                HRESULT hr = connectionPoint->Unadvise(cookie);
+                if FAILED(hr) {
+                    WARN_LOG("Unadvise of IOPCDataCallback returned error: {}", hresultToUTF8(hr));
                 }
-                if(asyncIO3) {
-                    asyncIO3.Release();
-                    asyncIO3 = nullptr;
+            });
+        }
+        if (itf->shutdownConnectionPoint) {
+            ATL::CComPtr<IConnectionPoint> connectionPoint = itf->shutdownConnectionPoint;
+            DWORD cookie = itf->shutdownHandle;
+            calls.push_back([connectionPoint, cookie] {
+                HRESULT hr = connectionPoint->Unadvise(cookie);
+                if FAILED(hr) {
+                    WARN_LOG("Unadvise of IOPCShutdown returned error: {}", hresultToUTF8(hr));
                 }
-                asyncDataCallbackConnectionPoint = nullptr;
-                asyncCallbackHandle = 0;
-                ERROR_LOG("Failed to retrieve interface pointer IID_IOPCDataCallback from class IID_IConnectionPointContainer. Cannot implement async read/write connection. Error: {}", hresultToUTF8(result));
-            }
+            });
+        }
+        shutdownReport.callsAbandoned += shutdownCalls(calls, calls.size(), deadline);
+    }
 
-            result = connectionPointContainer->FindConnectionPoint(IID_IOPCShutdown, &shutdownConnectionPoint);
-            if (SUCCEEDED(result)) {
-                HRESULT hrAuth = CoSetProxyBlanket(
-                    shutdownConnectionPoint, // the proxy to set
-                    RPC_C_AUTHN_WINNT, // authentication service
-                    RPC_C_AUTHZ_NONE, // authorization service
-                    NULL, // server principal name
-                    RPC_C_AUTHN_LEVEL_PKT_INTEGRITY, // authentication level
-                    RPC_C_IMP_LEVEL_IMPERSONATE, // impersonation level
-                    pAuthIdent, // authentication information
-                    EOAC_NONE // additional capabilities
-                );
-                if (FAILED(hrAuth)) {
-                    ERROR_LOG("CoSetProxyBlanket failed on the IConnectionPoint with error: {}", hresultToUTF8(hrAuth));
+    // no completion can arrive any more: pending transactions are cancelled on the server in parallel
+    std::vector<DWORD> pending;
+    transactions.forEachPending([&pending](DWORD transactionID) { pending.push_back(transactionID); });
+    if (serverCalls && (itf->asyncIO3 || itf->asyncIO2)) {
+        ATL::CComPtr<IOPCAsyncIO2> io2 = itf->asyncIO2;
+        ATL::CComPtr<IOPCAsyncIO3> io3 = itf->asyncIO3;
+        for (DWORD transactionID : pending) {
+            DWORD serverCancelID = transactions.serverCancelID(transactionID);
+            calls.push_back([io2, io3, serverCancelID] {
+                HRESULT hr = io3 ? io3->Cancel2(serverCancelID) : io2->Cancel2(serverCancelID);
+                if FAILED(hr) {
+                    WARN_LOG("Call to Cancel2 returned error: {}", hresultToUTF8(hr));
                 }
+            });
+        }
+        if (std::chrono::steady_clock::now() < deadline) {
+            shutdownReport.callsAbandoned += shutdownCalls(calls, shutdownCancelParallelism, deadline);
+        } else {
+            shutdownReport.callsAbandoned += calls.size();
+            calls.clear();
+        }
+    }
 
-                result = shutdownConnectionPoint->Advise((IUnknown *) ((IOPCShutdown *) this), &shutdownHandle);
-                if (FAILED(result)) {
-                    shutdownConnectionPoint = nullptr;
-                    shutdownHandle = 0;
-                    ERROR_LOG("Failed to retrieve handle of IOPCShutdown from class IID_IOPCShutdown. Cannot implement async shutdown connection. Error: {}",hresultToUTF8(result));
+    if (serverCalls) {
+        if (std::chrono::steady_clock::now() < deadline) {
+            ATL::CComPtr<IOPCServer> server = itf->server;
+            OPCHANDLE groupHandle = itf->groupHandle;
+            calls.push_back([server, groupHandle] {
+                HRESULT hr = server->RemoveGroup(groupHandle, TRUE);
+                if FAILED(hr) {
+                    ERROR_LOG("Call to IOPCSerer->RemoveGroup failed with error: {}", hresultToUTF8(hr));
                 }
-            } else {
-                asyncDataCallbackConnectionPoint = nullptr;
-                shutdownConnectionPoint = nullptr;
-                ERROR_LOG("Failed to retrieve interface pointer IID_IOPCShutdown from class IID_IConnectionPointContainer. Cannot implement async shutdown connection. Error: {}", hresultToUTF8(result));
-            }
+            });
+            shutdownReport.callsAbandoned += shutdownCalls(calls, 1, deadline);
+        } else {
+            shutdownReport.callsAbandoned++;
         }
     }
-}
-
 
-OPCGroup::~OPCGroup() {
-    asyncDisableAutoReadGroup();
-
-    std::map<DWORD,DWORD> copyIDs;
+    // quiescence barrier: callbacks already running are waited for until the deadline, later ones are refused
+    state = easyopcda::opcGroupState::closed;
     {
-        std::lock_guard<std::mutex> stackLock(transactionMutex);
-        copyIDs = clientServerTransactionID;
-   }
-
-    for (auto i = copyIDs.begin(); i != copyIDs.end(); ++i) {
-        HRESULT hr;
-        if (asyncIO3) {
-            hr = asyncIO3->Cancel2(i->second);
-            if FAILED(hr) {
-                error = true;
-                ERROR_LOG("Call to asyncIO3->Cancel2 returned error: {}", hresultToUTF8(hr));
-            }
-        } else if (asyncIO2) {
-            hr = asyncIO2->Cancel2(i->second);
-            if FAILED(hr) {
-                error = true;
-                ERROR_LOG("Call to asyncIO2->Read returned error: {}", hresultToUTF8(hr));
-            }
-        } else {
-            ERROR_LOG("No async interfaces available (support only IID_IOPCAsyncIO2 and IID_IOPCAsyncIO3");
-            return;
+        std::unique_lock<std::mutex> lock(callbackDrainMutex);
+        if (!callbackDrainCv.wait_until(lock, deadline, [this] { return callbacksInFlight == 0; })) {
+            shutdownReport.callbacksAbandoned = callbacksInFlight;
         }
     }
 
-    if (myOPCServer) {
-        HRESULT hr = myOPCServer->RemoveGroup(thisGroupHandle,TRUE);
-        if FAILED(hr) {
-            ERROR_LOG("Call to IOPCSerer->RemoveGroup failed with error: {}", hresultToUTF8(hr));
+    // including those issued while the group was closing
+    transactions.forEachPending([this](DWORD transactionID) {
+        if (transactions.transition(transactionID, transactionPhase::pending, transactionPhase::claimed)) {
+            finishTransaction(transactionID, connectionLost ? RPC_E_DISCONNECTED : E_ABORT, false);
+            shutdownReport.transactionsAborted++;
         }
-    }
-    myOPCServer = nullptr;
+    });
 
-    if (asyncDataCallbackConnectionPoint) asyncDataCallbackConnectionPoint->Unadvise(asyncCallbackHandle);
-    if (shutdownConnectionPoint) shutdownConnectionPoint->Unadvise(shutdownHandle);
+    // releasing a proxy is a call to the server as well: the reference of the group to its interfaces goes to a
+    // shutdown thread. a call still using them releases them when it returns
+    if (itf->server) {
+        calls.push_back([released = std::move(itf)]() mutable { released.reset(); });
+        shutdownReport.callsAbandoned += shutdownCalls(calls, 1, deadline);
+    }
 
-    for (auto it = itemsMap.begin(); it != itemsMap.end(); ++it) {
-        if (it->second.itemRes.pBlob) CoTaskMemFree(it->second.itemRes.pBlob);
+    shutdownReport.elapsedMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    shutdownReport.completed = shutdownReport.callsAbandoned == 0 && shutdownReport.callbacksAbandoned == 0;
+    if (shutdownReport.completed) {
+        INFO_LOG("Group {} shut down in {:.1f} ms, {} transactions aborted", wstringToUTF8(myName), shutdownReport.elapsedMs, shutdownReport.transactionsAborted);
+    } else {
+        WARN_LOG("Group {} shut down in {:.1f} ms abandoning {} server calls and {} callbacks, {} transactions aborted",
+                 wstringToUTF8(myName), shutdownReport.elapsedMs, shutdownReport.callsAbandoned, shutdownReport.callbacksAbandoned,
+                 shutdownReport.transactionsAborted);
     }
+    shutdownDone = true;
+    return shutdownReport;
 }
 
-
 void OPCGroup::addItems(std::vector<std::wstring> &inputItems) {
-    if (error) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
+    if (!itf->itemMgr) {
+        ERROR_LOG("Group {} has no item management interface", wstringToUTF8(myName));
+        return;
+    }
 
     std::vector<OPCITEMDEF> itemDefs;
     std::vector<std::wstring> itemNames;
@@ -388,9 +499,11 @@ void OPCGroup::addItems(std::vector<std::wstring> &inputItems) {
     HRESULT *pErrors = nullptr;
     HRESULT hr;
 
+    std::lock_guard<std::mutex> itemsLock(itemsMutex);
+    std::shared_ptr<const itemTable> table = loadItems();
 
     for (size_t i = 0; i < inputItems.size(); i++) {
-        if (itemsMap.count(inputItems[i]) == 0) {
+        if (table->byName.count(inputItems[i]) == 0) {
             OPCITEMDEF newItem;
             //	define an item table with one item as in-paramter for AddItem
             newItem.szAccessPath = &(std::wstring(L"")[0]); //	Accesspath not needed
@@ -402,7 +515,6 @@ void OPCGroup::addItems(std::vector<std::wstring> &inputItems) {
             newItem.vtRequestedDataType = 0; //	return values in native (cannonical) datatype
             itemDefs.push_back(newItem);
             itemNames.push_back(inputItems[i]);
-            clientItemHandlesMap[lastClientItemHandle] = inputItems[i];
         }
     }
 
@@ -410,16 +522,22 @@ void OPCGroup::addItems(std::vector<std::wstring> &inputItems) {
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread adding OPC items: {}", hid);
 
-    hr = itemMgr->AddItems(itemDefs.size(), itemDefs.data(), &pAddResult, &pErrors);
+    hr = itf->itemMgr->AddItems(itemDefs.size(), itemDefs.data(), &pAddResult, &pErrors);
     if SUCCEEDED(hr) {
+        auto next = std::make_shared<itemTable>(*table);
+        next->byClientHandle.resize(lastClientItemHandle + 1);
         for (size_t i = 0; i < itemDefs.size(); i++) {
             INFO_LOG("Requested tag: {} returned status: {}", wstringToUTF8(itemNames[i]), hresultToUTF8((pErrors[i])));
-            itemsMap[itemNames[i]].itemRes = pAddResult[i];
-            itemsMap[itemNames[i]].itemErr = pErrors[i];
+            auto def = std::make_shared<itemDef>(itemNames[i], pAddResult[i], itemDefs[i].hClient, pErrors[i]);
+            next->byName[itemNames[i]] = def;
+            next->byClientHandle[def->clientHandle] = def;
             serverItemHandlesMap[pAddResult[i].hServer] = itemNames[i];
         }
+        itemCount = next->byName.size();
+        publishItems(next);
     } else {
-        error = true;
+        degrade();
+        checkConnection(hr);
         ERROR_LOG("Call to AddItems returned error: {}", hresultToUTF8(hr));
     }
 
@@ -428,10 +546,15 @@ void OPCGroup::addItems(std::vector<std::wstring> &inputItems) {
 }
 
 void OPCGroup::validateItems(std::vector<std::wstring> &inputItems) {
-    if (error) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
+    if (!itf->itemMgr) {
+        ERROR_LOG("Group {} has no item management interface", wstringToUTF8(myName));
+        return;
+    }
 
     std::map<std::wstring, OPCITEMDEF> localItemsMap;
     std::vector<OPCITEMDEF> itemDefs;
@@ -458,16 +581,17 @@ void OPCGroup::validateItems(std::vector<std::wstring> &inputItems) {
         }
     }
 
-    hr = itemMgr->ValidateItems(itemDefs.size(), itemDefs.data(), false, &pAddResult, &pErrors);
+    hr = itf->itemMgr->ValidateItems(itemDefs.size(), itemDefs.data(), false, &pAddResult, &pErrors);
     if SUCCEEDED(hr) {
+        std::lock_guard<std::mutex> itemsLock(itemsMutex);
+        std::shared_ptr<const itemTable> table = loadItems();
         for (auto i = 0; i < itemDefs.size(); i++) {
             INFO_LOG("Requested tag: {} returned status: {}", wstringToUTF8(itemNames[i]), hresultToUTF8(pErrors[i]));
-            if (itemsMap.count(itemNames[i]) > 0) {
-                itemsMap[itemNames[i]].itemErr = pErrors[i];
-            }
+            if (itemDef *def = table->find(itemNames[i])) def->itemErr = pErrors[i];
         }
+        invalidateActiveItems();
     } else {
-        error = true;
+        degrade();
         ERROR_LOG("Call to ValidateItems returned error: {]", hresultToUTF8(hr));
     }
 
@@ -482,7 +606,7 @@ void OPCGroup::validateItems(std::vector<std::wstring> &inputItems) {
 }
 
 void OPCGroup::removeItems(std::vector<std::wstring> &items) {
-    if (error) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
@@ -490,64 +614,85 @@ void OPCGroup::removeItems(std::vector<std::wstring> &items) {
     ERROR_LOG("not yet implemented");
 }
 
+std::shared_ptr<activeItemSet> OPCGroup::getActiveItems() {
+    std::shared_ptr<activeItemSet> items = std::atomic_load(&activeItems);
+    if (items) return items;
+
+    uint64_t version = activeItemsVersion;
+    std::shared_ptr<const itemTable> table = loadItems();
+    items = std::make_shared<activeItemSet>();
+    for (auto i = table->byName.begin(); i != table->byName.end(); ++i) {
+        if SUCCEEDED(i->second->itemErr.load()) {
+            items->serverHandles.push_back(i->second->itemRes.hServer);
+            items->clientHandles.push_back(i->second->clientHandle);
+            items->names.push_back(i->first);
+        }
+    }
+    // not cached if invalidated meanwhile: the set may miss the change
+    if (activeItemsVersion == version) {
+        std::atomic_store(&activeItems, items);
+        if (activeItemsVersion != version) std::atomic_store(&activeItems, std::shared_ptr<activeItemSet>());
+    }
+    return items;
+}
+
+void OPCGroup::publishItems(std::shared_ptr<const itemTable> table) {
+    std::atomic_store(&currentItems, std::move(table));
+    invalidateActiveItems();
+}
+
+void OPCGroup::invalidateActiveItems() {
+    activeItemsVersion++;
+    std::atomic_store(&activeItems, std::shared_ptr<activeItemSet>());
+}
+
 void OPCGroup::syncReadGroup() {
-    if (error) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
 
-    std::vector<OPCHANDLE> itemHandles;
-    std::vector<std::wstring> itemNames;
+    std::shared_ptr<activeItemSet> items = getActiveItems();
+    std::vector<OPCHANDLE> &itemHandles = items->serverHandles;
     OPCITEMSTATE *pItemValues = nullptr;
     HRESULT *pErrors = nullptr;
 
-    for (auto i = itemsMap.begin(); i != itemsMap.end(); ++i) {
-        if SUCCEEDED(i->second.itemErr) {
-            itemNames.push_back(i->first);
-            itemHandles.push_back(i->second.itemRes.hServer);
-        }
-    }
-
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread sync reading group: {}",hid);
 
     HRESULT hr;
-    if (syncIO2) {
-        hr = syncIO2->Read(OPC_DS_CACHE, itemHandles.size(), itemHandles.data(), &pItemValues, &pErrors);
+    if (itf->syncIO2) {
+        hr = itf->syncIO2->Read(OPC_DS_CACHE, itemHandles.size(), itemHandles.data(), &pItemValues, &pErrors);
         // we can use ReadMaxAge here
-    } else if (syncIO) {
-        hr = syncIO->Read(OPC_DS_CACHE, itemHandles.size(), itemHandles.data(), &pItemValues, &pErrors);
+    } else if (getSyncIO(*itf)) {
+        hr = itf->syncIO->Read(OPC_DS_CACHE, itemHandles.size(), itemHandles.data(), &pItemValues, &pErrors);
     } else {
         ERROR_LOG("No sync read interfaces available! operation not performed");
         return;
     }
     if SUCCEEDED(hr) {
-        std::vector<OPCHANDLE> clientHandles(itemHandles.size());
+        // values come back in request order, so the client handles of the item set match them
         std::vector<VARIANT> VARIANTValues(itemHandles.size());
         std::vector<WORD> qualityValues(itemHandles.size());
         std::vector<FILETIME> timeValues(itemHandles.size());
-        std::vector<HRESULT> errors(itemHandles.size());
         for (auto i = 0; i < itemHandles.size(); i++) {
-            clientHandles[i]=pItemValues[i].hClient;
             VARIANTValues[i]=pItemValues[i].vDataValue;
             qualityValues[i]=pItemValues[i].wQuality;
             timeValues[i] = pItemValues[i].ftTimeStamp;
-            errors[i]=pErrors[i];
         }
         INFO_LOG("Sync Read processed {} items",itemHandles.size());
-        internalAsyncCallback(itemHandles.size(),clientHandles.data(), VARIANTValues.data(), qualityValues.data(),timeValues.data(),errors.data());
+        internalAsyncCallback(itemHandles.size(),items->clientHandles.data(), VARIANTValues.data(), qualityValues.data(),timeValues.data(),pErrors);
 
         for (auto i = 0; i < itemHandles.size(); i++) {
             if FAILED(pErrors[i]) {
-                if (clientItemHandlesMap.count(pItemValues[i].hClient)>0)
-                   WARN_LOG("Call to SyncIO returned error for specific item: {:<20}: {}", wstringToUTF8(clientItemHandlesMap[pItemValues[i].hClient]), hresultToUTF8(hr));
+                WARN_LOG("Call to SyncIO returned error for specific item: {:<20}: {}", wstringToUTF8(items->names[i]), hresultToUTF8(hr));
             } else {
-                if (clientItemHandlesMap.count(pItemValues[i].hClient)>0)
-                    INFO_LOG(
+                INFO_LOG(
                         "group: {:<10}item: {:<20}time: {:<30}\tvalue: {:<20}\tquality: {:<15}\terror: {:<15}",
                         wstringToUTF8(myName),
-                        wstringToUTF8(clientItemHandlesMap[pItemValues[i].hClient]),
+                        wstringToUTF8(items->names[i]),
                         FileTimeToChrono(pItemValues[i].ftTimeStamp),
                         variant2UTF8(pItemValues[i].vDataValue),
                         opcQualityToUTF8(pItemValues[i].wQuality),
@@ -556,7 +701,8 @@ void OPCGroup::syncReadGroup() {
             }
         }
     } else {
-        error = true;
+        degrade();
+        checkConnection(hr);
         ERROR_LOG("Call to SyncIO returned error: {}", hresultToUTF8(hr));
     }
 
@@ -565,7 +711,7 @@ void OPCGroup::syncReadGroup() {
         for (auto i = 0; i < itemHandles.size(); i++) {
             hr = VariantClear(&(pItemValues[i].vDataValue));
             if FAILED(hr) {
-                error = true;
+                degrade();
                 ERROR_LOG("Call to VariantClear returned error: {}", hresultToUTF8(hr));
             }
         }
@@ -574,61 +720,84 @@ void OPCGroup::syncReadGroup() {
     if (pErrors != NULL) CoTaskMemFree(pErrors);
 }
 
-void OPCGroup::asyncReadGroup() {
-    if (error) {
+OPCCompletion<easyopcda::opcReadResult> OPCGroup::asyncReadGroup() {
+    OPCCompletion<easyopcda::opcReadResult> completion;
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
-        return;
+        completion.complete({E_FAIL, {}});
+        return completion;
     }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
 
-    std::vector<OPCHANDLE> itemHandles;
-    std::vector<std::wstring> itemNames;
+    std::shared_ptr<activeItemSet> items = getActiveItems();
+    std::vector<OPCHANDLE> &itemHandles = items->serverHandles;
+    const std::vector<std::wstring> &itemNames = items->names;
     DWORD serverCancelID = 0;
     HRESULT *pErrors = nullptr;
 
-    for (auto i = itemsMap.begin(); i != itemsMap.end(); ++i) {
-        if SUCCEEDED(i->second.itemErr) {
-            itemNames.push_back(i->first);
-            itemHandles.push_back(i->second.itemRes.hServer);
+    if (!itf->asyncIO3 && !itf->asyncIO2) {
+        ERROR_LOG("No async interfaces available (support only IID_IOPCAsyncIO2 and IID_IOPCAsyncIO3");
+        completion.complete({E_NOINTERFACE, {}});
+        return completion;
+    }
+
+    if (maxReadsInFlight > 0) {
+        std::unique_lock<std::mutex> stackLock(readWindowMutex);
+        if (readsInFlight >= readWindow) {
+            if (!blockOnReadWindowFull) {
+                readsRejected++;
+                stackLock.unlock();
+                WARN_LOG("Async Read of group {} rejected: {} reads in flight", wstringToUTF8(myName), readsInFlight.load());
+                completion.complete({HRESULT_FROM_WIN32(ERROR_BUSY), {}});
+                return completion;
+            }
+            // slots are released by OnReadComplete, OnCancelComplete or the transaction expiry
+            readWindowCv.wait(stackLock, [this] { return maxReadsInFlight == 0 || readsInFlight < readWindow; });
         }
+        readsInFlight++;
+    } else {
+        readsInFlight++;
     }
 
-    HRESULT hr;
-    {
-        std::lock_guard<std::mutex> stackLock(transactionMutex);
-        while (clientServerTransactionID.count(++lastClientTransactionID) != 0);
+    // the transaction is registered before the call: the server may call OnReadComplete before Read returns
+    DWORD transactionID = registerTransaction(true);
+    if (transactionID == 0) {
+        readsInFlight--;
+        if (maxReadsInFlight > 0) {
+            std::lock_guard<std::mutex> stackLock(readWindowMutex);
+            readWindowCv.notify_one();
+        }
+        WARN_LOG("Async Read of group {} rejected: too many transactions in flight", wstringToUTF8(myName));
+        completion.complete({HRESULT_FROM_WIN32(ERROR_BUSY), {}});
+        return completion;
     }
+    readTransaction &transaction = transactions.payload(transactionID).read;
+    transaction.completion = completion;
+    transaction.issueTime = std::chrono::steady_clock::now();
 
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread async reading group: {}",hid);
 
-    if (asyncIO3) {
-        hr = asyncIO3->Read(itemHandles.size(), itemHandles.data(), lastClientTransactionID, &serverCancelID, &pErrors);
+    HRESULT hr;
+    if (itf->asyncIO3) {
+        hr = itf->asyncIO3->Read(itemHandles.size(), itemHandles.data(), transactionID, &serverCancelID, &pErrors);
         if FAILED(hr) {
-            error = true;
+            degrade();
+            checkConnection(hr);
             ERROR_LOG("Call to asyncIO3->Read returned error: {}", hresultToUTF8(hr));
-            return;
         }
-    } else if (asyncIO2) {
-        hr = asyncIO2->Read(itemHandles.size(), itemHandles.data(), lastClientTransactionID, &serverCancelID, &pErrors);
+    } else {
+        hr = itf->asyncIO2->Read(itemHandles.size(), itemHandles.data(), transactionID, &serverCancelID, &pErrors);
         if FAILED(hr) {
-            error = true;
+            degrade();
+            checkConnection(hr);
             ERROR_LOG("Call to asyncIO2->Read returned error: {}", hresultToUTF8(hr));
-            return;
         }
-    } else {
-        ERROR_LOG("No async interfaces available (support only IID_IOPCAsyncIO2 and IID_IOPCAsyncIO3");
-        return;
     }
 
-    {
-        std::lock_guard<std::mutex> stackLock(transactionMutex);
-        clientServerTransactionID[lastClientTransactionID] = serverCancelID;
-    }
-
-    INFO_LOG("Async Read processed {} items",itemHandles.size());
-
-    if (!error) {
+    if SUCCEEDED(hr) {
+        INFO_LOG("Async Read processed {} items",itemHandles.size());
         if (pErrors) {
             for (auto i = 0; i < itemHandles.size(); i++) {
                 if(FAILED(pErrors[i]))
@@ -637,23 +806,420 @@ void OPCGroup::asyncReadGroup() {
         }
     }
 
+    // items rejected by Read are not reported again in OnReadComplete
+    bool anyAccepted = false;
+    transactionPhase claim = claimForIssuer(transactionID);
+    if FAILED(hr) transaction.result.error = hr;
+    for (size_t i = 0; i < itemHandles.size(); i++) {
+        HRESULT itemError = FAILED(hr) ? hr : (pErrors ? pErrors[i] : S_OK);
+        if FAILED(itemError) {
+            FILETIME noTime = {0, 0};
+            transaction.result.values.push_back({itemNames[i], noTime, ATL::CComVariant(), OPC_QUALITY_BAD, itemError});
+        } else {
+            anyAccepted = true;
+        }
+    }
+
     if (pErrors != NULL) CoTaskMemFree(pErrors);
+
+    // the slot may be reused as soon as it is handed over: transaction must not be touched after this call
+    completeIssue(transactionID, claim, anyAccepted, serverCancelID);
+
+    return completion;
 }
 
 void OPCGroup::syncReadItems(std::vector<std::wstring> &items) {
-    if (error) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
     ERROR_LOG("not yet implemented");
 }
 
-void OPCGroup::syncWriteItems(std::vector<std::wstring> &items, std::vector<double> values) {
-    if (error) {
+HRESULT OPCGroup::prepareWriteValue(const itemTable &table, const easyopcda::opcWriteValue &item, VARIANT &dest, const itemDef *&def) {
+    VariantInit(&dest);
+
+    const itemDef *found = table.find(item.tagName);
+    if (!found) {
+        return OPC_E_UNKNOWNITEMID;
+    }
+    HRESULT itemErr = found->itemErr;
+    if FAILED(itemErr) {
+        return itemErr;
+    }
+
+    def = found;
+
+    VARTYPE canonicalType = found->itemRes.vtCanonicalDataType;
+    if (canonicalType == VT_EMPTY || canonicalType == item.value.vt) {
+        return VariantCopy(&dest, &item.value);
+    }
+
+    HRESULT hr = VariantChangeType(&dest, &item.value, 0, canonicalType);
+    if FAILED(hr) {
+        VariantInit(&dest);
+        return OPC_E_BADTYPE;
+    }
+    return hr;
+}
+
+void OPCGroup::prepareWriteBuffer(std::vector<easyopcda::opcWriteValue> &items, bool vqtAvailable, writeBuffer &buffer, std::vector<HRESULT> &results) {
+    buffer.vqt = false;
+    for (auto &item : items) {
+        if (item.qualitySpecified || item.timestampSpecified) buffer.vqt = true;
+    }
+    if (buffer.vqt && !vqtAvailable) {
+        WARN_LOG("WriteVQT not available: quality and timestamp will not be written");
+        buffer.vqt = false;
+    }
+
+    // values are converted straight into a single buffer sent to the server with one call
+    buffer.serverHandles.reserve(items.size());
+    buffer.clientHandles.reserve(items.size());
+    buffer.itemIndexes.reserve(items.size());
+    if (buffer.vqt) buffer.vqtValues.resize(items.size());
+    else buffer.values.resize(items.size());
+
+    // handles are copied into the buffer, so the table is needed only while it is filled
+    std::shared_ptr<const itemTable> table = loadItems();
+    for (size_t i = 0; i < items.size(); i++) {
+        size_t k = buffer.serverHandles.size();
+        VARIANT &dest = buffer.vqt ? buffer.vqtValues[k].vDataValue : buffer.values[k];
+        const itemDef *def = nullptr;
+        HRESULT hr = prepareWriteValue(*table, items[i], dest, def);
+        if FAILED(hr) {
+            results[i] = hr;
+            WARN_LOG("Write requested tag: {:<20} could not be prepared: {}", wstringToUTF8(items[i].tagName), hresultToUTF8(hr));
+            continue;
+        }
+        if (buffer.vqt) {
+            buffer.vqtValues[k].bQualitySpecified = items[i].qualitySpecified ? TRUE : FALSE;
+            buffer.vqtValues[k].wQuality = items[i].quality;
+            buffer.vqtValues[k].wReserved = 0;
+            buffer.vqtValues[k].bTimeStampSpecified = items[i].timestampSpecified ? TRUE : FALSE;
+            buffer.vqtValues[k].dwReserved = 0;
+            buffer.vqtValues[k].ftTimeStamp = items[i].timestamp;
+        }
+        buffer.serverHandles.push_back(def->itemRes.hServer);
+        buffer.clientHandles.push_back(def->clientHandle);
+        buffer.itemIndexes.push_back(i);
+    }
+}
+
+std::vector<HRESULT> OPCGroup::syncWriteItems(std::vector<easyopcda::opcWriteValue> &items) {
+    std::vector<HRESULT> results(items.size(), E_FAIL);
+    if (!acceptsRequests()) {
+        ERROR_LOG("OPC connection in error state. cannot accept further requests");
+        return results;
+    }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
+
+    writeBuffer buffer;
+    prepareWriteBuffer(items, itf->syncIO2 != nullptr, buffer, results);
+    if (buffer.serverHandles.empty()) {
+        WARN_LOG("Sync Write has no valid items to write");
+        return results;
+    }
+
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread sync writing items: {}", hid);
+
+    HRESULT *pErrors = nullptr;
+    HRESULT hr;
+    if (buffer.vqt) {
+        hr = itf->syncIO2->WriteVQT(buffer.serverHandles.size(), buffer.serverHandles.data(), buffer.vqtValues.data(), &pErrors);
+    } else if (itf->syncIO2) {
+        hr = itf->syncIO2->Write(buffer.serverHandles.size(), buffer.serverHandles.data(), buffer.values.data(), &pErrors);
+    } else if (getSyncIO(*itf)) {
+        hr = itf->syncIO->Write(buffer.serverHandles.size(), buffer.serverHandles.data(), buffer.values.data(), &pErrors);
+    } else {
+        // a missing interface is not a failure of the server: the group is not degraded
+        ERROR_LOG("No sync write interfaces available! operation not performed");
+        for (size_t k = 0; k < buffer.serverHandles.size(); k++) {
+            results[buffer.itemIndexes[k]] = E_NOINTERFACE;
+        }
+        return results;
+    }
+
+    if (SUCCEEDED(hr) && pErrors) {
+        for (size_t k = 0; k < buffer.serverHandles.size(); k++) {
+            results[buffer.itemIndexes[k]] = pErrors[k];
+            if FAILED(pErrors[k]) {
+                WARN_LOG("Sync Write requested tag: {:<20} returned status: {}", wstringToUTF8(items[buffer.itemIndexes[k]].tagName), hresultToUTF8(pErrors[k]));
+            }
+        }
+        INFO_LOG("Sync Write processed {} items", buffer.serverHandles.size());
+    } else {
+        for (size_t k = 0; k < buffer.serverHandles.size(); k++) {
+            results[buffer.itemIndexes[k]] = hr;
+        }
+        degrade();
+        checkConnection(hr);
+        ERROR_LOG("Call to SyncIO Write returned error: {}", hresultToUTF8(hr));
+    }
+
+    if (pErrors != NULL) CoTaskMemFree(pErrors);
+
+    return results;
+}
+
+OPCCompletion<std::vector<HRESULT>> OPCGroup::asyncWriteItems(std::vector<easyopcda::opcWriteValue> &items) {
+    std::vector<HRESULT> results(items.size(), E_FAIL);
+    OPCCompletion<std::vector<HRESULT>> completion;
+    if (!acceptsRequests()) {
+        ERROR_LOG("OPC connection in error state. cannot accept further requests");
+        completion.complete(std::move(results));
+        return completion;
+    }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
+    if (!itf->asyncIO3 && !itf->asyncIO2) {
+        ERROR_LOG("No async interfaces available (support only IID_IOPCAsyncIO2 and IID_IOPCAsyncIO3");
+        std::fill(results.begin(), results.end(), E_NOINTERFACE);
+        completion.complete(std::move(results));
+        return completion;
+    }
+
+    writeBuffer buffer;
+    prepareWriteBuffer(items, itf->asyncIO3 != nullptr, buffer, results);
+    if (buffer.serverHandles.empty()) {
+        WARN_LOG("Async Write has no valid items to write");
+        completion.complete(std::move(results));
+        return completion;
+    }
+
+    // the transaction is registered before the call: the server may call OnWriteComplete before Write returns
+    DWORD transactionID = registerTransaction(false);
+    if (transactionID == 0) {
+        WARN_LOG("Async Write of group {} rejected: too many transactions in flight", wstringToUTF8(myName));
+        for (size_t k = 0; k < buffer.itemIndexes.size(); k++) results[buffer.itemIndexes[k]] = HRESULT_FROM_WIN32(ERROR_BUSY);
+        completion.complete(std::move(results));
+        return completion;
+    }
+    writeTransaction &transaction = transactions.payload(transactionID).write;
+    transaction.clientHandleIndexes.reserve(buffer.clientHandles.size());
+    for (size_t k = 0; k < buffer.clientHandles.size(); k++) {
+        transaction.clientHandleIndexes.emplace_back(buffer.clientHandles[k], buffer.itemIndexes[k]);
+    }
+    std::sort(transaction.clientHandleIndexes.begin(), transaction.clientHandleIndexes.end());
+    transaction.results = results;
+    transaction.answered.assign(results.size(), false);
+    transaction.completion = completion;
+
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread async writing items: {}", hid);
+
+    DWORD serverCancelID = 0;
+    HRESULT *pErrors = nullptr;
+    HRESULT hr;
+    if (buffer.vqt) {
+        hr = itf->asyncIO3->WriteVQT(buffer.serverHandles.size(), buffer.serverHandles.data(), buffer.vqtValues.data(), transactionID, &serverCancelID, &pErrors);
+    } else if (itf->asyncIO3) {
+        hr = itf->asyncIO3->Write(buffer.serverHandles.size(), buffer.serverHandles.data(), buffer.values.data(), transactionID, &serverCancelID, &pErrors);
+    } else {
+        hr = itf->asyncIO2->Write(buffer.serverHandles.size(), buffer.serverHandles.data(), buffer.values.data(), transactionID, &serverCancelID, &pErrors);
+    }
+
+    if FAILED(hr) {
+        degrade();
+        checkConnection(hr);
+        ERROR_LOG("Call to AsyncIO Write returned error: {}", hresultToUTF8(hr));
+    } else {
+        INFO_LOG("Async Write processed {} items", buffer.serverHandles.size());
+        if (pErrors) {
+            for (size_t k = 0; k < buffer.serverHandles.size(); k++) {
+                if FAILED(pErrors[k])
+                    WARN_LOG("Async Write requested tag: {:<20} returned status: {}", wstringToUTF8(items[buffer.itemIndexes[k]].tagName), hresultToUTF8(pErrors[k]));
+            }
+        }
+    }
+
+    // items rejected by Write are not reported again in OnWriteComplete.
+    // S_FALSE: some items failed. if none was accepted, the server will not call back
+    bool anyAccepted = false;
+    transactionPhase claim = claimForIssuer(transactionID);
+    for (size_t k = 0; k < buffer.serverHandles.size(); k++) {
+        size_t index = buffer.itemIndexes[k];
+        if (FAILED(hr)) transaction.results[index] = hr;
+        else if (pErrors && FAILED(pErrors[k])) transaction.results[index] = pErrors[k];
+        else {
+            anyAccepted = true;
+            continue;
+        }
+        transaction.answered[index] = true;
+    }
+
+    if (pErrors != NULL) CoTaskMemFree(pErrors);
+
+    // the slot may be reused as soon as it is handed over: transaction must not be touched after this call
+    completeIssue(transactionID, claim, anyAccepted, serverCancelID);
+
+    return completion;
+}
+
+void OPCGroup::enableWriteQueue(DWORD windowMs, size_t maxItems) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
-    ERROR_LOG("not yet implemented");
+    if (!executor || !timer) {
+        ERROR_LOG("Write queue of group {} needs an executor and a timer", wstringToUTF8(myName));
+        return;
+    }
+    if (maxItems == 0) maxItems = 1;
+
+    {
+        std::lock_guard<std::mutex> lock(writeQueueMutex);
+        writeQueueWindow = windowMs;
+        writeQueueMaxItems = maxItems;
+        if (writeQueueRunning) {
+            // the open window may end later than its timer
+            if (!queuedWrites.empty()) scheduleWriteFlush(writeQueueWindowStart + std::chrono::milliseconds(windowMs));
+            INFO_LOG("Write queue of group {} reconfigured: window {} ms, max {} items", wstringToUTF8(myName), windowMs, maxItems);
+            return;
+        }
+        writeQueueRunning = true;
+    }
+
+    INFO_LOG("Write queue of group {} enabled: window {} ms, max {} items", wstringToUTF8(myName), windowMs, maxItems);
+}
+
+void OPCGroup::disableWriteQueue() {
+    {
+        std::lock_guard<std::mutex> lock(writeQueueMutex);
+        if (!writeQueueRunning) return;
+        writeQueueRunning = false;
+    }
+    // what is still queued is flushed here, or by the flush in progress. an async write in flight is not waited
+    // for: the windows left are written when it completes, or when shutdown aborts it
+    flushWriteQueue();
+    {
+        std::unique_lock<std::mutex> lock(writeQueueMutex);
+        writeQueueCv.wait(lock, [this] { return writeQueueAwaiting || (!writeQueueFlushing && queuedWrites.empty()); });
+    }
+    INFO_LOG("Write queue of group {} disabled", wstringToUTF8(myName));
+}
+
+OPCCompletion<HRESULT> OPCGroup::queueWrite(const easyopcda::opcWriteValue &value) {
+    OPCCompletion<HRESULT> completion;
+    bool windowOpened = false;
+    bool full = false;
+    std::chrono::steady_clock::time_point windowEnd;
+    {
+        std::lock_guard<std::mutex> lock(writeQueueMutex);
+        if (!writeQueueRunning) {
+            ERROR_LOG("Write queue of group {} is not enabled", wstringToUTF8(myName));
+            completion.complete(E_ILLEGAL_METHOD_CALL);
+            return completion;
+        }
+
+        auto it = queuedWriteIndexes.find(value.tagName);
+        if (it != queuedWriteIndexes.end()) {
+            queuedWrites[it->second].value = value;
+            queuedWrites[it->second].submitters.push_back(completion);
+        } else {
+            if (queuedWrites.empty()) {
+                writeQueueWindowStart = std::chrono::steady_clock::now();
+                windowOpened = true;
+            }
+            queuedWriteIndexes[value.tagName] = queuedWrites.size();
+            queuedWrites.push_back({value, {completion}});
+        }
+        windowEnd = writeQueueWindowStart + std::chrono::milliseconds(writeQueueWindow);
+        full = queuedWrites.size() >= writeQueueMaxItems;
+    }
+
+    if (full) {
+        std::shared_ptr<OPCGroup> self = holdReference();
+        if (!executor->post([self] { self->flushWriteQueue(); })) flushWriteQueue();
+    } else if (windowOpened) {
+        scheduleWriteFlush(windowEnd);
+    }
+
+    return completion;
+}
+
+// called with writeQueueMutex held. a window is due when elapsed, full, or left when the queue was disabled
+bool OPCGroup::writeQueueDue() const {
+    if (queuedWrites.empty()) return false;
+    if (!writeQueueRunning || queuedWrites.size() >= writeQueueMaxItems) return true;
+    return std::chrono::steady_clock::now() >= writeQueueWindowStart + std::chrono::milliseconds(writeQueueWindow);
+}
+
+// starts a flush unless one is in progress, which then writes the due windows as well. while a flush is on the
+// wire the next window keeps filling, so batches grow with load
+void OPCGroup::flushWriteQueue() {
+    {
+        std::lock_guard<std::mutex> lock(writeQueueMutex);
+        if (writeQueueFlushing) return;
+        writeQueueFlushing = true;
+    }
+    writeDueWindows();
+}
+
+// run by the flush in progress until no window is due. an async write is not waited for: its completion, on the
+// callback thread or at its deadline, continues the flush on the executor, so no worker blocks on the server
+void OPCGroup::writeDueWindows() {
+    std::unique_lock<std::mutex> lock(writeQueueMutex);
+    while (writeQueueDue()) {
+        auto batch = std::make_shared<std::vector<queuedWrite>>();
+        batch->swap(queuedWrites);
+        queuedWriteIndexes.clear();
+        lock.unlock();
+
+        std::vector<easyopcda::opcWriteValue> items;
+        items.reserve(batch->size());
+        for (auto &write : *batch) items.push_back(write.value);
+
+        if (getSyncIO(*loadInterfaces())) {
+            std::vector<HRESULT> results = syncWriteItems(items);
+            DEBUG_LOG("Write queue of group {} flushed {} tags", wstringToUTF8(myName), items.size());
+            for (size_t i = 0; i < batch->size(); i++) {
+                for (auto &submitter : (*batch)[i].submitters) submitter.complete(results[i]);
+            }
+            lock.lock();
+            continue;
+        }
+
+        lock.lock();
+        writeQueueAwaiting = true;
+        lock.unlock();
+        writeQueueCv.notify_all();
+
+        std::shared_ptr<OPCGroup> self = holdReference();
+        asyncWriteItems(items).then([self, batch](const std::vector<HRESULT> &results) {
+            DEBUG_LOG("Write queue of group {} flushed {} tags", wstringToUTF8(self->myName), batch->size());
+            for (size_t i = 0; i < batch->size(); i++) {
+                for (auto &submitter : (*batch)[i].submitters) submitter.complete(results[i]);
+            }
+            bool running;
+            {
+                std::lock_guard<std::mutex> lock(self->writeQueueMutex);
+                self->writeQueueAwaiting = false;
+                running = self->writeQueueRunning;
+            }
+            // once the queue is disabled nobody waits for a worker: the windows left are written here
+            if (!running || !self->executor->post([self] { self->writeDueWindows(); })) self->writeDueWindows();
+        });
+        return;
+    }
+    // a window not yet due is flushed by its own timer
+    writeQueueFlushing = false;
+    lock.unlock();
+    writeQueueCv.notify_all();
+}
+
+void OPCGroup::scheduleWriteFlush(std::chrono::steady_clock::time_point time) {
+    std::shared_ptr<OPCGroup> self = holdReference();
+    timer->schedule(time, [self] {
+        self->executor->post([self] { self->flushWriteQueue(); });
+    });
+}
+
+std::shared_ptr<OPCGroup> OPCGroup::holdReference() {
+    AddRef();
+    return std::shared_ptr<OPCGroup>(this, [](OPCGroup *group) { group->Release(); });
 }
 
 // implementation of DCOM interfaces
@@ -695,9 +1261,9 @@ STDMETHODIMP_(ULONG) OPCGroup::AddRef() {
 } // AddRef
 
 STDMETHODIMP_(ULONG) OPCGroup::Release() {
-    DWORD count = ReferencesCount ? --ReferencesCount : 0;
-    if (!count) {
-        //delete this;
+    ULONG count = --ReferencesCount;
+    if (count == 0) {
+        delete this;
     }
     return count;
 } // Release
@@ -705,16 +1271,22 @@ STDMETHODIMP_(ULONG) OPCGroup::Release() {
 // implementation of OPC callback
 HRESULT OPCGroup::internalAsyncCallback(DWORD count, OPCHANDLE *clientHandles, VARIANT *values, WORD *quality,
                                         FILETIME *time, HRESULT *errors) {
+    // one table for the whole call: items added meanwhile are published without waiting for it
+    std::shared_ptr<const itemTable> table = loadItems();
+    auto sink = std::atomic_load(&batchSink);
+    easyopcda::opcGroupBatch batch = {groupId, priority, {}, {}};
+    if (sink) {
+        batch.values.reserve(count);
+        batch.clientHandles.reserve(count);
+    }
     for (auto i = 0; i < count; i++) {
-        OPCHANDLE itemHandle = clientHandles[i];
-        if (clientItemHandlesMap.count(itemHandle) > 0) {
-            std::wstring itemName = clientItemHandlesMap[itemHandle];
+        if (itemDef *def = table->find(clientHandles[i])) {
+            const std::wstring &itemName = def->name;
             HRESULT error = S_OK;
             if (errors) {
-                if (itemsMap.count(itemName) > 0) {
-                    if (itemsMap[itemName].itemErr != errors[i]) itemsMap[itemName].itemErr = errors[i];
-                    error = errors[i];
-                }
+                HRESULT previous = def->itemErr.exchange(errors[i]);
+                if (FAILED(previous) != FAILED(errors[i])) invalidateActiveItems();
+                error = errors[i];
             }
             INFO_LOG(
                "group: {:<10}item: {:<20}time: {:<30}\tvalue: {:<20}\tquality: {:<15}\terror: {:<15}",
@@ -725,13 +1297,19 @@ HRESULT OPCGroup::internalAsyncCallback(DWORD count, OPCHANDLE *clientHandles, V
                 opcQualityToUTF8(quality[i]),
                 hresultToUTF8(error)
                 );
-            externalAsyncCallback(myName, {itemName, time[i], values[i], quality[i], error});
+            if (externalAsyncCallback) externalAsyncCallback(myName, {itemName, time[i], values[i], quality[i], error});
+            if (sink) {
+                batch.values.push_back({itemName, time[i], ATL::CComVariant(values[i]), quality[i], error});
+                batch.clientHandles.push_back(clientHandles[i]);
+            }
         } else {
             ERROR_LOG("Invalid client item handle passed to async callback function");
+            if (sink && !batch.values.empty()) (*sink)(std::move(batch));
             return S_FALSE;
         }
     }
 
+    if (sink && !batch.values.empty()) (*sink)(std::move(batch));
     return S_OK;
 }
 
@@ -739,156 +1317,588 @@ STDMETHODIMP OPCGroup::OnDataChange(DWORD transactionID, OPCHANDLE groupHandle,
                                     HRESULT masterError,
                                     DWORD count, OPCHANDLE *clientHandles, VARIANT *values, WORD *quality,
                                     FILETIME *time, HRESULT *errors) {
-    if (isError()) {
-        ERROR_LOG("OPC connection in error state. cannot accept further requests");
+    // data arriving while the group closes is dropped
+    if (!enterCallback(false)) {
+        DEBUG_LOG("OPC group closing. data change dropped");
         return E_FAIL;
     }
 
-    {
-        std::lock_guard<std::mutex> stackLock(transactionMutex);
-        if (clientServerTransactionID.count(transactionID) > 0) {
-            clientServerTransactionID.erase(transactionID);
-        }
-    }
-    cv.notify_all();
-
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread running OnDataChange: {}", hid);
 
-    return internalAsyncCallback(count, clientHandles, values, quality, time, errors);
+    HRESULT hr = internalAsyncCallback(count, clientHandles, values, quality, time, errors);
+    leaveCallback();
+    return hr;
 }
 
 STDMETHODIMP OPCGroup::OnReadComplete(DWORD transactionID, OPCHANDLE groupHandle, HRESULT masterQuality,
                                       HRESULT masterError,
                                       DWORD count, OPCHANDLE *clientHandles, VARIANT *values, WORD *quality,
                                       FILETIME *time, HRESULT *errors) {
-    if (isError()) {
-        ERROR_LOG("OPC connection in error state. cannot accept further requests");
+    // a read completing while the group closes still completes its transaction
+    if (!enterCallback(true)) {
+        ERROR_LOG("OPC group closed. callback refused");
         return E_FAIL;
     }
 
-    {
-        std::lock_guard<std::mutex> stackLock(transactionMutex);
-        if (clientServerTransactionID.count(transactionID) > 0) {
-            clientServerTransactionID.erase(transactionID);
-        }
-    }
-    cv.notify_all();
-
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread running OnReadComplete {}",hid);
 
-    return internalAsyncCallback(count, clientHandles, values, quality, time, errors);
+    transactionPhase claim = claimForCallback(transactionID);
+    if (claim != transactionPhase::stale) {
+        readTransaction &transaction = transactions.payload(transactionID).read;
+        transaction.result.values.reserve(transaction.result.values.size() + count);
+        std::shared_ptr<const itemTable> table = loadItems();
+        for (DWORD i = 0; i < count; i++) {
+            const itemDef *def = table->find(clientHandles[i]);
+            if (!def) continue;
+            transaction.result.values.push_back({def->name, time[i], ATL::CComVariant(values[i]), quality[i], errors ? errors[i] : masterError});
+        }
+        // before Read returned, the issuing thread completes the transaction
+        if (claim == transactionPhase::earlyWriting) transactions.publish(transactionID, transactionPhase::earlyDone);
+    }
+
+    HRESULT hr = internalAsyncCallback(count, clientHandles, values, quality, time, errors);
+
+    if (claim == transactionPhase::claimed) finishTransaction(transactionID, S_OK, false);
+
+    leaveCallback();
+    return hr;
 }
 
 STDMETHODIMP OPCGroup::OnWriteComplete(DWORD transactionID, OPCHANDLE groupHandle, HRESULT masterError, DWORD count, OPCHANDLE *clientHandles, HRESULT *errors) {
-    if (error) {
-        ERROR_LOG("OPC connection in error state. cannot accept further requests");
+    if (!enterCallback(true)) {
+        ERROR_LOG("OPC group closed. callback refused");
         return E_FAIL;
     }
-    ERROR_LOG("not yet implemented");
+    HRESULT hr = completeWrite(transactionID, masterError, count, clientHandles, errors);
+    leaveCallback();
+    return hr;
+}
+
+HRESULT OPCGroup::completeWrite(DWORD transactionID, HRESULT masterError, DWORD count, OPCHANDLE *clientHandles, HRESULT *errors) {
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread running OnWriteComplete {}",hid);
+
+    transactionPhase claim = claimForCallback(transactionID);
+    if (claim == transactionPhase::stale) {
+        WARN_LOG("OnWriteComplete called for unknown transaction {}", transactionID);
+        return S_OK;
+    }
+
+    writeTransaction &transaction = transactions.payload(transactionID).write;
+    for (DWORD i = 0; i < count; i++) {
+        auto range = std::equal_range(transaction.clientHandleIndexes.begin(), transaction.clientHandleIndexes.end(),
+                                      std::make_pair(clientHandles[i], size_t(0)),
+                                      [](const std::pair<OPCHANDLE, size_t> &a, const std::pair<OPCHANDLE, size_t> &b) { return a.first < b.first; });
+        for (auto j = range.first; j != range.second; ++j) {
+            transaction.results[j->second] = errors ? errors[i] : masterError;
+            transaction.answered[j->second] = true;
+        }
+    }
+
+    if (claim == transactionPhase::earlyWriting) transactions.publish(transactionID, transactionPhase::earlyDone);
+    else finishTransaction(transactionID, S_OK, false);
+
+    INFO_LOG("Async Write completed {} items with master error: {}", count, hresultToUTF8(masterError));
     return S_OK;
 }
 
 STDMETHODIMP OPCGroup::OnCancelComplete(DWORD transactionID, OPCHANDLE groupHandle) {
-    if (isError()) {
-        ERROR_LOG("OPC connection in error state. cannot accept further requests");
+    if (!enterCallback(true)) {
+        ERROR_LOG("OPC group closed. callback refused");
         return E_FAIL;
     }
 
-    {
-        std::lock_guard<std::mutex> stackLock(transactionMutex);
-        if (clientServerTransactionID.count(transactionID) > 0) {
-            clientServerTransactionID.erase(transactionID);
+    // Cancel2 needs the cancel ID returned by the server call, so the transaction is pending by now
+    bool claimed = false;
+    for (;;) {
+        transactionPhase phase = transactions.phase(transactionID);
+        if (phase == transactionPhase::issuerWriting) {
+            std::this_thread::yield();
+            continue;
+        }
+        if (phase != transactionPhase::pending) break;
+        if (transactions.transition(transactionID, transactionPhase::pending, transactionPhase::claimed)) {
+            claimed = true;
+            break;
         }
     }
-    cv.notify_all();
 
+    if (claimed) {
+        transactionsCancelled++;
+        finishTransaction(transactionID, E_ABORT, false);
+    }
+
+    leaveCallback();
     return S_OK;
 }
 
 void OPCGroup::waitForTransactionsComplete() {
     std::unique_lock<std::mutex> lock(transactionMutex);
-    if(!clientServerTransactionID.empty()) {
-        cv.wait(lock, [this] { return (this->clientServerTransactionID.empty()); } );
+    idleCv.wait(lock, [this] { return transactions.outstandingCount() == 0; } );
+}
+
+bool OPCGroup::waitForTransactionsComplete(DWORD timeoutMs) {
+    std::unique_lock<std::mutex> lock(transactionMutex);
+    return idleCv.wait_for(lock, std::chrono::milliseconds(timeoutMs), [this] { return transactions.outstandingCount() == 0; } );
+}
+
+void OPCGroup::setTransactionTimeout(DWORD timeoutMs) {
+    transactionTimeout = timeoutMs;
+}
+
+void OPCGroup::setMaxReadsInFlight(DWORD maxInFlight, bool blockWhenFull) {
+    {
+        std::lock_guard<std::mutex> stackLock(readWindowMutex);
+        maxReadsInFlight = maxInFlight;
+        blockOnReadWindowFull = blockWhenFull;
+        readWindow = maxInFlight;
+        readWindowCredit = 0;
+    }
+    // waiters re-check against the new window
+    readWindowCv.notify_all();
+    INFO_LOG("Group {} max async reads in flight: {}", wstringToUTF8(myName), maxInFlight);
+}
+
+easyopcda::opcGroupMetrics OPCGroup::getMetrics() {
+    std::lock_guard<std::mutex> stackLock(readWindowMutex);
+    return {transactionsIssued.load(), transactionsCompleted.load(), transactionsCancelled.load(), transactionsTimedOut.load(),
+            readsRejected.load(), readsInFlight.load(), readWindow, readLatencyAverage.load(), loadInterfaces()->roundTrips};
+}
+
+// frees the window slot of a read and adapts the window
+void OPCGroup::releaseReadSlot(std::chrono::steady_clock::time_point issueTime, bool congested) {
+    readsInFlight--;
+
+    auto now = std::chrono::steady_clock::now();
+    double latency = std::chrono::duration<double, std::milli>(now - issueTime).count();
+    double average = readLatencyAverage.load();
+    while (!readLatencyAverage.compare_exchange_weak(average, (average == 0) ? latency : 0.8 * average + 0.2 * latency));
+
+    if (maxReadsInFlight == 0) return;
+
+    {
+        std::lock_guard<std::mutex> stackLock(readWindowMutex);
+        // the minimum ages slowly so that a permanent change of the server round trip is eventually accepted
+        readLatencyMin = (readLatencyMin == 0) ? latency : std::min(latency, readLatencyMin * 1.01);
+
+        if (congested || latency > 2 * readLatencyMin) {
+            // at most one decrease per average round trip, so one burst of slow answers does not collapse the window
+            if (now - lastReadWindowDecrease > std::chrono::duration<double, std::milli>(readLatencyAverage.load())) {
+                readWindow = std::max<DWORD>(1, readWindow / 2);
+                readWindowCredit = 0;
+                lastReadWindowDecrease = now;
+            }
+        } else if (readWindow < maxReadsInFlight && ++readWindowCredit >= readWindow) {
+            readWindow++;
+            readWindowCredit = 0;
+        }
+    }
+    readWindowCv.notify_one();
+}
+
+// takes a transaction slot and arms its deadline. returns 0 when the transaction table is full
+DWORD OPCGroup::registerTransaction(bool isRead) {
+    DWORD transactionID = transactions.acquire();
+    if (transactionID == 0) return 0;
+    asyncTransaction &transaction = transactions.payload(transactionID);
+    transaction.isRead = isRead;
+    transaction.deadlineTimer = 0;
+    transactionsIssued++;
+
+    DWORD timeoutMs = transactionTimeout;
+    if (timeoutMs > 0 && timer && executor) {
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeoutMs);
+        // the deadline keeps the group alive until it expired or the transaction finished
+        std::shared_ptr<OPCGroup> self = holdReference();
+        transaction.deadlineTimer = timer->schedule(deadline, [self, transactionID] {
+            self->executor->post([self, transactionID] { self->expireTransaction(transactionID); });
+        });
+    }
+    return transactionID;
+}
+
+// called by the issuing thread when the server call returned. waits for a callback that is recording
+// its results, then owns the payload until completeIssue
+transactionPhase OPCGroup::claimForIssuer(DWORD transactionID) {
+    for (;;) {
+        transactionPhase phase = transactions.phase(transactionID);
+        if (phase == transactionPhase::issuing) {
+            if (transactions.transition(transactionID, transactionPhase::issuing, transactionPhase::issuerWriting)) return transactionPhase::issuerWriting;
+        } else if (phase == transactionPhase::earlyWriting) {
+            std::this_thread::yield();
+        } else {
+            // earlyDone or abandoned: nobody else touches the slot any more
+            return phase;
+        }
+    }
+}
+
+void OPCGroup::completeIssue(DWORD transactionID, transactionPhase claim, bool anyAccepted, DWORD serverCancelID) {
+    if (claim == transactionPhase::abandoned) {
+        // timed out while the server call was in progress
+        if (anyAccepted) cancelServerTransaction(transactionID, serverCancelID);
+        finishTransaction(transactionID, HRESULT_FROM_WIN32(ERROR_TIMEOUT), true);
+    } else if (claim == transactionPhase::earlyDone || !anyAccepted) {
+        finishTransaction(transactionID, S_OK, false);
+    } else {
+        transactions.setServerCancelID(transactionID, serverCancelID);
+        transactions.publish(transactionID, transactionPhase::pending);
+    }
+}
+
+// claims the transaction for its server callback. returns earlyWriting when the server call has not returned
+// yet, claimed when the callback completes the transaction, stale for unknown or already completed transactions
+transactionPhase OPCGroup::claimForCallback(DWORD transactionID) {
+    for (;;) {
+        transactionPhase phase = transactions.phase(transactionID);
+        if (phase == transactionPhase::issuing) {
+            if (transactions.transition(transactionID, transactionPhase::issuing, transactionPhase::earlyWriting)) return transactionPhase::earlyWriting;
+        } else if (phase == transactionPhase::issuerWriting) {
+            std::this_thread::yield();
+        } else if (phase == transactionPhase::pending) {
+            if (transactions.transition(transactionID, transactionPhase::pending, transactionPhase::claimed)) return transactionPhase::claimed;
+        } else {
+            return transactionPhase::stale;
+        }
+    }
+}
+
+// completes a transaction owned by the caller and frees its slot. transactionError fails the whole
+// read, or the write items the server did not answer
+void OPCGroup::finishTransaction(DWORD transactionID, HRESULT transactionError, bool congested) {
+    asyncTransaction &transaction = transactions.payload(transactionID);
+    bool isRead = transaction.isRead;
+    uint64_t deadlineTimer = transaction.deadlineTimer;
+    transaction.deadlineTimer = 0;
+    OPCCompletion<easyopcda::opcReadResult> readCompletion;
+    easyopcda::opcReadResult readResult;
+    OPCCompletion<std::vector<HRESULT>> writeCompletion;
+    std::vector<HRESULT> writeResults;
+
+    if (isRead) {
+        if FAILED(transactionError) transaction.read.result.error = transactionError;
+        readCompletion = transaction.read.completion;
+        readResult = std::move(transaction.read.result);
+        transaction.read.result = {S_OK, {}};
+        releaseReadSlot(transaction.read.issueTime, congested);
+    } else {
+        if FAILED(transactionError) {
+            for (auto &item : transaction.write.clientHandleIndexes) {
+                if (!transaction.write.answered[item.second]) transaction.write.results[item.second] = transactionError;
+            }
+        }
+        writeCompletion = transaction.write.completion;
+        writeResults = std::move(transaction.write.results);
+        transaction.write.results.clear();
+        transaction.write.answered.clear();
+        transaction.write.clientHandleIndexes.clear();
+    }
+
+    if (transactionError != HRESULT_FROM_WIN32(ERROR_TIMEOUT)) transactionsCompleted++;
+    if (transactions.release(transactionID)) {
+        std::lock_guard<std::mutex> stackLock(transactionMutex);
+        idleCv.notify_all();
+    }
+
+    if (isRead) readCompletion.complete(std::move(readResult));
+    else writeCompletion.complete(std::move(writeResults));
+
+    // drops the group reference of the deadline. a no-op when the deadline itself expired the transaction.
+    // last: the caller holds a reference of its own, but nothing of the slot is touched afterwards
+    if (deadlineTimer != 0) timer->cancel(deadlineTimer);
+}
+
+void OPCGroup::cancelServerTransaction(DWORD transactionID, DWORD serverCancelID) {
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
+    HRESULT hr = E_NOINTERFACE;
+    if (itf->asyncIO3) hr = itf->asyncIO3->Cancel2(serverCancelID);
+    else if (itf->asyncIO2) hr = itf->asyncIO2->Cancel2(serverCancelID);
+    if FAILED(hr) {
+        WARN_LOG("Cancel2 of timed out transaction {} returned error: {}", transactionID, hresultToUTF8(hr));
+    }
+}
+
+// run on the executor at the deadline of the transaction. shutdown aborts the transactions left by itself
+void OPCGroup::expireTransaction(DWORD transactionID) {
+    easyopcda::opcGroupState current = state;
+    if (current == easyopcda::opcGroupState::closing || current == easyopcda::opcGroupState::closed) return;
+
+    // stale IDs (transaction answered, slot possibly reused) fail every transition
+    transactionPhase claim = transactionPhase::stale;
+    for (;;) {
+        transactionPhase phase = transactions.phase(transactionID);
+        if (phase == transactionPhase::issuing) {
+            // the issuing thread completes it when the server call returns
+            if (transactions.transition(transactionID, transactionPhase::issuing, transactionPhase::abandoned)) {
+                claim = transactionPhase::abandoned;
+                break;
+            }
+        } else if (phase == transactionPhase::issuerWriting) {
+            std::this_thread::yield();
+        } else if (phase == transactionPhase::pending) {
+            if (transactions.transition(transactionID, transactionPhase::pending, transactionPhase::claimed)) {
+                claim = transactionPhase::claimed;
+                break;
+            }
+        } else {
+            break;
+        }
+    }
+
+    if (claim != transactionPhase::stale) {
+        transactionsTimedOut++;
+        WARN_LOG("Transaction {} of group {} timed out", transactionID, wstringToUTF8(myName));
+    }
+    // a late OnReadComplete/OnWriteComplete for this ID finds it stale and is only delivered to the callback
+    if (claim == transactionPhase::claimed) {
+        cancelServerTransaction(transactionID, transactions.serverCancelID(transactionID));
+        finishTransaction(transactionID, HRESULT_FROM_WIN32(ERROR_TIMEOUT), true);
     }
 }
 
 void OPCGroup::asyncEnableAutoReadGroup() {
-    if (error) {
+    if (!acceptsRequests()) {
         ERROR_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
 
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     ERROR_LOG("Thread setting group and items active: {}", hid);
 
-    if (groupMgr) {
+    if (itf->groupMgr) {
         DWORD rUpRt;
         BOOL active = FALSE;
-        HRESULT hr = groupMgr->SetState(nullptr, &rUpRt, &active, nullptr, nullptr, nullptr, nullptr);
+        HRESULT hr = itf->groupMgr->SetState(nullptr, &rUpRt, &active, nullptr, nullptr, nullptr, nullptr);
         if FAILED(hr) {
-            error = true;
+            degrade();
+            checkConnection(hr);
             ERROR_LOG("Call to IOPCGroup->SetState failed");
             return;
         }
 
-        std::vector<OPCHANDLE> handles;
-        for (auto i = itemsMap.begin(); i != itemsMap.end(); ++i) {
-            handles.push_back(i->second.itemRes.hServer);
-        }
+        std::shared_ptr<activeItemSet> items = getActiveItems();
+        std::vector<OPCHANDLE> &handles = items->serverHandles;
         active = TRUE;
         HRESULT *pErrors;
 
-        if (itemMgr) {
-            hr = itemMgr->SetActiveState(handles.size(), handles.data(), active, &pErrors);
+        if (itf->itemMgr) {
+            hr = itf->itemMgr->SetActiveState(handles.size(), handles.data(), active, &pErrors);
             if FAILED(hr) {
-                error = true;
+                degrade();
+                checkConnection(hr);
                 ERROR_LOG("Call to IOPCItem->SetActiveState failed");
                 return;
             }
         }
-        hr = groupMgr->SetState(nullptr, &rUpRt, &active, nullptr, nullptr, nullptr, nullptr);
+        hr = itf->groupMgr->SetState(nullptr, &rUpRt, &active, nullptr, nullptr, nullptr, nullptr);
         if FAILED(hr) {
-            error = true;
+            degrade();
+            checkConnection(hr);
             ERROR_LOG("Call to IOPCGroup->SetState failed");
             return;
         }
     }
+    autoReadEnabled = true;
+    changeState({easyopcda::opcGroupState::inactive, easyopcda::opcGroupState::degraded}, easyopcda::opcGroupState::active);
     INFO_LOG("group and items set active");
 }
 
 void OPCGroup::asyncDisableAutoReadGroup() {
-    if (error) {
+    if (!acceptsRequests()) {
         DEBUG_LOG("OPC connection in error state. cannot accept further requests");
         return;
     }
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
 
     auto tid = std::this_thread::get_id();
     auto hid = std::hash<std::thread::id>{}(tid);
     DEBUG_LOG("Thread setting group and items inactive: {}", hid);
 
-    if (groupMgr) {
+    if (itf->groupMgr) {
         DWORD rUpRt;
         BOOL active = FALSE;
-        HRESULT hr = groupMgr->SetState(nullptr, &rUpRt, &active, nullptr, nullptr, nullptr, nullptr);
+        HRESULT hr = itf->groupMgr->SetState(nullptr, &rUpRt, &active, nullptr, nullptr, nullptr, nullptr);
         if FAILED(hr) {
-            error = true;
+            degrade();
+            checkConnection(hr);
             ERROR_LOG("Call to IOPCItem->SetState failed. Error: {}", hresultToUTF8(hr));
             return;
         }
     }
+    autoReadEnabled = false;
+    changeState({easyopcda::opcGroupState::active, easyopcda::opcGroupState::degraded}, easyopcda::opcGroupState::inactive);
     INFO_LOG("group set inactive");
 }
 
 STDMETHODIMP OPCGroup::ShutdownRequest(LPCWSTR szReason) {
-    if (error) {
-        ERROR_LOG("OPC connection in error state. cannot accept further requests");
-        return E_FAIL;
+    if (!enterCallback(false)) return S_OK;
+    std::string reason = szReason ? wstringToUTF8(szReason) : "";
+    WARN_LOG("Server requested shutdown of group {}: {}", wstringToUTF8(myName), reason);
+    changeState({easyopcda::opcGroupState::creating, easyopcda::opcGroupState::active, easyopcda::opcGroupState::inactive,
+                 easyopcda::opcGroupState::degraded}, easyopcda::opcGroupState::reconnecting);
+    if (!connectionLost.exchange(true) && connectionLostHandler) connectionLostHandler("server shutdown: " + reason);
+    leaveCallback();
+    return S_OK;
+}
+
+void OPCGroup::checkConnection(HRESULT hr) {
+    if (!isServerUnavailable(hr)) return;
+    changeState({easyopcda::opcGroupState::creating, easyopcda::opcGroupState::active, easyopcda::opcGroupState::inactive,
+                 easyopcda::opcGroupState::degraded}, easyopcda::opcGroupState::reconnecting);
+    if (!connectionLost.exchange(true) && connectionLostHandler) connectionLostHandler(hresultToUTF8(hr));
+}
+
+bool OPCGroup::changeState(std::initializer_list<easyopcda::opcGroupState> from, easyopcda::opcGroupState to) {
+    easyopcda::opcGroupState current = state;
+    do {
+        if (std::find(from.begin(), from.end(), current) == from.end()) return false;
+    } while (!state.compare_exchange_weak(current, to));
+    return true;
+}
+
+bool OPCGroup::acceptsRequests() const {
+    easyopcda::opcGroupState current = state;
+    return current == easyopcda::opcGroupState::inactive || current == easyopcda::opcGroupState::active ||
+           current == easyopcda::opcGroupState::degraded;
+}
+
+bool OPCGroup::isError() const {
+    easyopcda::opcGroupState current = state;
+    return current != easyopcda::opcGroupState::inactive && current != easyopcda::opcGroupState::active;
+}
+
+// a failed call does not stop the group: it keeps accepting requests until a state change succeeds
+void OPCGroup::degrade() {
+    changeState({easyopcda::opcGroupState::active, easyopcda::opcGroupState::inactive}, easyopcda::opcGroupState::degraded);
+}
+
+// the counter is raised before the state is checked, so a callback either sees the group closing or is waited for.
+// the callback holds a reference until leaveCallback
+bool OPCGroup::enterCallback(bool whileClosing) {
+    AddRef();
+    callbacksInFlight++;
+    easyopcda::opcGroupState current = state;
+    if (current == easyopcda::opcGroupState::closed || (current == easyopcda::opcGroupState::closing && !whileClosing)) {
+        leaveCallback();
+        return false;
     }
-    ERROR_LOG("not yet implemented");
+    return true;
+}
+
+// the group may be freed by the Release, nothing is touched after it
+void OPCGroup::leaveCallback() {
+    if (--callbacksInFlight == 0 && state == easyopcda::opcGroupState::closed) {
+        std::lock_guard<std::mutex> lock(callbackDrainMutex);
+        callbackDrainCv.notify_all();
+    }
+    Release();
+}
+
+void OPCGroup::setBatchSink(std::function<void(easyopcda::opcGroupBatch &&batch)> sink) {
+    std::shared_ptr<const std::function<void(easyopcda::opcGroupBatch &&batch)>> published;
+    if (sink) published = std::make_shared<const std::function<void(easyopcda::opcGroupBatch &&batch)>>(std::move(sink));
+    std::atomic_store(&batchSink, published);
+}
+
+void OPCGroup::setConnectionLostHandler(std::function<void(const std::string &cause)> handler) {
+    connectionLostHandler = std::move(handler);
+}
+
+HRESULT OPCGroup::reconnect(CComPtr<IOPCServer> &pOPCServer) {
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread reconnecting OPC group: {}", hid);
+
+    // a group closed by shutdown is not brought back
+    if (shutdownDone || !changeState({easyopcda::opcGroupState::creating, easyopcda::opcGroupState::active, easyopcda::opcGroupState::inactive,
+                                      easyopcda::opcGroupState::degraded, easyopcda::opcGroupState::reconnecting, easyopcda::opcGroupState::closed},
+                                     easyopcda::opcGroupState::reconnecting)) {
+        return E_ABORT;
+    }
+    connectionLost = true;
+
+    // the lost server will not call back: transactions waiting for it fail now. those still in a server call
+    // are completed by their issuing thread when the call fails
+    transactions.forEachPending([this](DWORD transactionID) {
+        if (transactions.transition(transactionID, transactionPhase::pending, transactionPhase::claimed)) {
+            finishTransaction(transactionID, RPC_E_DISCONNECTED, false);
+        }
+    });
+
+    HRESULT hr = attachToServer(pOPCServer);
+    if FAILED(hr) return hr;
+    std::shared_ptr<groupInterfaces> itf = loadInterfaces();
+
+    // items are added with the canonical types returned by the lost server, so the server has no type to resolve.
+    // items whose type changed are added again in their native type. client handles are kept
+    std::lock_guard<std::mutex> itemsLock(itemsMutex);
+    std::shared_ptr<const itemTable> table = loadItems();
+    auto next = std::make_shared<itemTable>(*table);
+    std::wstring accessPath;
+    auto addStoredItems = [this, &itf, &accessPath, &table, &next](std::vector<std::wstring> &names, bool knownTypes, std::vector<std::wstring> &badType) {
+        std::vector<OPCITEMDEF> itemDefs;
+        for (auto &name : names) {
+            const itemDef &def = *table->byName.at(name);
+            OPCITEMDEF newItem;
+            newItem.szAccessPath = &accessPath[0];
+            newItem.szItemID = &name[0];
+            newItem.bActive = FALSE;
+            newItem.hClient = def.clientHandle;
+            newItem.dwBlobSize = 0;
+            newItem.pBlob = nullptr;
+            newItem.vtRequestedDataType = knownTypes ? def.itemRes.vtCanonicalDataType : VT_EMPTY;
+            itemDefs.push_back(newItem);
+        }
+
+        OPCITEMRESULT *pAddResult = nullptr;
+        HRESULT *pErrors = nullptr;
+        HRESULT hr = itf->itemMgr->AddItems(itemDefs.size(), itemDefs.data(), &pAddResult, &pErrors);
+        if SUCCEEDED(hr) {
+            for (size_t i = 0; i < names.size(); i++) {
+                if (knownTypes && pErrors[i] == OPC_E_BADTYPE) {
+                    badType.push_back(names[i]);
+                    continue;
+                }
+                auto def = std::make_shared<itemDef>(names[i], pAddResult[i], itemDefs[i].hClient, pErrors[i]);
+                next->byName[names[i]] = def;
+                next->byClientHandle[def->clientHandle] = def;
+                serverItemHandlesMap[pAddResult[i].hServer] = names[i];
+            }
+        } else {
+            ERROR_LOG("Call to AddItems returned error: {}", hresultToUTF8(hr));
+        }
+        if (pAddResult) CoTaskMemFree(pAddResult);
+        if (pErrors) CoTaskMemFree(pErrors);
+        return hr;
+    };
+
+    std::vector<std::wstring> names;
+    for (auto &it : table->byName) names.push_back(it.first);
+    serverItemHandlesMap.clear();
+    if (!names.empty()) {
+        std::vector<std::wstring> badType;
+        hr = addStoredItems(names, true, badType);
+        if (SUCCEEDED(hr) && !badType.empty()) {
+            WARN_LOG("{} items of group {} changed type and are added in their native type", badType.size(), wstringToUTF8(myName));
+            std::vector<std::wstring> none;
+            hr = addStoredItems(badType, false, none);
+        }
+        if FAILED(hr) return hr;
+    }
+    publishItems(next);
+
+    connectionLost = false;
+    changeState({easyopcda::opcGroupState::reconnecting}, easyopcda::opcGroupState::inactive);
+    if (autoReadEnabled) asyncEnableAutoReadGroup();
+    if (isError()) return E_FAIL;
+
+    INFO_LOG("Group {} reconnected with {} items", wstringToUTF8(myName), names.size());
     return S_OK;
 }
@@ -0,0 +1,120 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opchealthmonitor.h"
+
+#include <algorithm>
+#include <iterator>
+
+
+OPCHealthMonitor::OPCHealthMonitor(std::function<CComPtr<IOPCServer>()> serverSource, const easyopcda::opcHealthPolicy &policy, easyopcda::ServerHealthCallback callback)
+    : serverSource(std::move(serverSource)), policy(policy), callback(std::move(callback)) {
+    if (this->policy.periodMs == 0) this->policy.periodMs = 1000;
+
+    FILETIME noTime = {0, 0};
+    health = {false, OPC_STATUS_FAILED, 0, 0xFFFFFFFF, noTime, noTime, noTime, false, 0, 0, 0, 0, 0, {}};
+    health.latencyHistogram.assign(std::size(easyopcda::healthLatencyBucketsMs) + 1, 0);
+
+    running = true;
+    monitorThread = std::thread(&OPCHealthMonitor::monitor, this);
+}
+
+OPCHealthMonitor::~OPCHealthMonitor() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_all();
+    if (monitorThread.joinable()) monitorThread.join();
+}
+
+easyopcda::opcServerHealth OPCHealthMonitor::getHealth() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return health;
+}
+
+bool OPCHealthMonitor::isThrottled(const easyopcda::opcServerHealth &current) const {
+    if (!current.reachable || current.state != OPC_STATUS_RUNNING) return true;
+    if (policy.latencyThresholdMs > 0 && current.averageLatencyMs > policy.latencyThresholdMs) return true;
+    if (policy.bandWidthThreshold > 0 && current.bandWidth != 0xFFFFFFFF && current.bandWidth > policy.bandWidthThreshold) return true;
+    return false;
+}
+
+void OPCHealthMonitor::check() {
+    CComPtr<IOPCServer> server = serverSource();
+    if (!server) return;
+
+    OPCSERVERSTATUS *status = nullptr;
+    auto start = std::chrono::steady_clock::now();
+    HRESULT hr = server->GetStatus(&status);
+    double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+    std::unique_lock<std::mutex> lock(mutex);
+    easyopcda::opcServerHealth previous = health;
+    health.polls++;
+    if (SUCCEEDED(hr) && status) {
+        health.reachable = true;
+        health.state = status->dwServerState;
+        health.groupCount = status->dwGroupCount;
+        health.bandWidth = status->dwBandWidth;
+        health.startTime = status->ftStartTime;
+        health.currentTime = status->ftCurrentTime;
+        health.lastUpdateTime = status->ftLastUpdateTime;
+
+        health.lastLatencyMs = latency;
+        health.averageLatencyMs = (health.averageLatencyMs == 0) ? latency : 0.8 * health.averageLatencyMs + 0.2 * latency;
+        health.maxLatencyMs = std::max(health.maxLatencyMs, latency);
+        auto bucket = std::lower_bound(std::begin(easyopcda::healthLatencyBucketsMs), std::end(easyopcda::healthLatencyBucketsMs), latency);
+        health.latencyHistogram[bucket - std::begin(easyopcda::healthLatencyBucketsMs)]++;
+    } else {
+        health.reachable = false;
+        health.failures++;
+        WARN_LOG("GetStatus failed. Error: {}", hresultToUTF8(hr));
+    }
+    health.throttled = isThrottled(health);
+    if (status) {
+        if (status->szVendorInfo) CoTaskMemFree(status->szVendorInfo);
+        CoTaskMemFree(status);
+    }
+
+    bool changed = previous.reachable != health.reachable || previous.state != health.state || previous.throttled != health.throttled;
+    if (!changed) return;
+    easyopcda::opcServerHealth current = health;
+    lock.unlock();
+
+    INFO_LOG("Server health changed: reachable {}, state {}, throttled {}", current.reachable, static_cast<int>(current.state), current.throttled);
+    if (callback) callback(previous, current);
+}
+
+void OPCHealthMonitor::monitor() {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on health monitor thread. Error code = {}", hresultToUTF8(hrInit));
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        lock.unlock();
+        check();
+        lock.lock();
+        cv.wait_for(lock, std::chrono::milliseconds(policy.periodMs), [this] { return !running; });
+    }
+    lock.unlock();
+
+    if SUCCEEDED(hrInit) CoUninitialize();
+}
@@ -23,12 +23,18 @@
 #include <utility>
 
 
-OPCInit::OPCInit(easyopcda::ASyncCallback func)
+// worker threads of the executor when not specified
+static const size_t defaultExecutorThreads = 4;
+
+OPCInit::OPCInit(easyopcda::ASyncCallback func) : OPCInit(std::move(func), defaultExecutorThreads) {}
+
+OPCInit::OPCInit(easyopcda::ASyncCallback func, size_t threads)
 //    : ss_sink(std::make_shared<spdlog::sinks::ostream_sink_mt>(ss)),
 //      logger(std::make_shared<spdlog::logger>("easyopcda", ss_sink))
 {
     error=false;
     mClient = nullptr;
+    mExecutor = nullptr;
     mCallbackFunc = std::move(func);
 
     auto tid = std::this_thread::get_id();
@@ -55,12 +61,16 @@ OPCInit::OPCInit(easyopcda::ASyncCallback func)
 
     if(!error) {
         INFO_LOG("DCOM initialized");
-        mClient = new OPCClient(mCallbackFunc);
+        mExecutor = new OPCExecutor("opc", threads);
+        mClient = new OPCClient(mCallbackFunc, mExecutor);
     }
 }
 
 OPCInit::~OPCInit() {
+    // queued calls may still use the client, and the client tears its groups down on the executor
+    if (mExecutor) mExecutor->drain();
     delete mClient;
+    delete mExecutor;
     DEBUG_LOG("Calling CoUninitialize");
     CoUninitialize();
 }
@@ -73,4 +83,12 @@ OPCClient *OPCInit::getClient() {
     return mClient;
 }
 
+OPCExecutor *OPCInit::getExecutor() {
+    if (error) {
+        ERROR_LOG("Client in error state cannot further process requests");
+        return nullptr;
+    }
+    return mExecutor;
+}
+
 
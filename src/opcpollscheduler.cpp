@@ -0,0 +1,179 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcpollscheduler.h"
+
+#include <algorithm>
+
+
+OPCPollScheduler::OPCPollScheduler(size_t threads, double jitterFraction)
+    : executor("poll", threads), jitterFraction(jitterFraction), random(std::random_device{}()) {
+    running = true;
+    timerThread = std::thread(&OPCPollScheduler::timer, this);
+}
+
+OPCPollScheduler::~OPCPollScheduler() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+        for (auto &it : groups) it.second->removed = true;
+        groups.clear();
+    }
+    cv.notify_all();
+    if (timerThread.joinable()) timerThread.join();
+    // reads in progress complete before the groups can be deleted
+    executor.shutdown();
+}
+
+void OPCPollScheduler::startPolling(const std::wstring &name, OPCGroup *group, DWORD periodMs) {
+    if (group == nullptr || periodMs == 0) {
+        ERROR_LOG("Invalid polling request for group {}", wstringToUTF8(name));
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto &entry = groups[name];
+        if (!entry) {
+            entry = std::make_shared<polledGroup>();
+            entry->group = group;
+            entry->schedule = 0;
+            entry->running = false;
+            entry->removed = false;
+            entry->stats = {0, 0, 0, 0, 0, 0, 0};
+            entry->throttleSkip = false;
+        } else {
+            entry->schedule++;
+        }
+        entry->period = std::chrono::milliseconds(periodMs);
+        entry->stats.periodMs = periodMs;
+
+        // random phase offset within the first period
+        std::uniform_int_distribution<long long> offset(0, entry->period.count() - 1);
+        entry->nextDue = std::chrono::steady_clock::now() + std::chrono::milliseconds(offset(random));
+        due.emplace(entry->nextDue + jitter(entry->period), std::make_pair(entry->schedule, entry));
+    }
+    cv.notify_one();
+
+    INFO_LOG("Group {} polled every {} ms", wstringToUTF8(name), periodMs);
+}
+
+void OPCPollScheduler::stopPolling(const std::wstring &name) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = groups.find(name);
+    if (it == groups.end()) return;
+
+    std::shared_ptr<polledGroup> entry = it->second;
+    entry->removed = true;
+    groups.erase(it);
+    idleCv.wait(lock, [&entry] { return !entry->running; });
+
+    INFO_LOG("Group {} no longer polled", wstringToUTF8(name));
+}
+
+void OPCPollScheduler::setThrottle(std::function<bool()> throttled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    this->throttled = std::move(throttled);
+}
+
+bool OPCPollScheduler::getPollStats(const std::wstring &name, easyopcda::opcPollStats &stats) {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it = groups.find(name);
+    if (it == groups.end()) return false;
+    stats = it->second->stats;
+    return true;
+}
+
+std::chrono::steady_clock::duration OPCPollScheduler::jitter(std::chrono::milliseconds period) {
+    auto maxJitter = static_cast<long long>(std::chrono::duration_cast<std::chrono::microseconds>(period).count() * jitterFraction);
+    if (maxJitter <= 0) return std::chrono::steady_clock::duration::zero();
+    std::uniform_int_distribution<long long> delay(0, maxJitter);
+    return std::chrono::microseconds(delay(random));
+}
+
+void OPCPollScheduler::timer() {
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        if (due.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        if (std::chrono::steady_clock::now() < due.top().first) {
+            cv.wait_until(lock, due.top().first);
+            continue;
+        }
+        pollEntry next = due.top();
+        due.pop();
+
+        std::shared_ptr<polledGroup> entry = next.second.second;
+        if (entry->removed || next.second.first != entry->schedule) continue;
+
+        // the next cycle stays on the intended grid, so jitter and late wake-ups do not accumulate
+        auto now = std::chrono::steady_clock::now();
+        entry->nextDue += entry->period;
+        if (entry->nextDue <= now) {
+            auto missed = (now - entry->nextDue) / entry->period + 1;
+            entry->nextDue += missed * entry->period;
+            entry->stats.skipped += missed;
+        }
+        due.emplace(entry->nextDue + jitter(entry->period), std::make_pair(entry->schedule, entry));
+
+        if (entry->running) {
+            entry->stats.skipped++;
+            continue;
+        }
+        // a throttled client polls every other cycle
+        if (throttled && throttled()) {
+            entry->throttleSkip = !entry->throttleSkip;
+            if (entry->throttleSkip) {
+                entry->stats.throttled++;
+                continue;
+            }
+        }
+        entry->running = true;
+        if (!executor.post([this, entry] { poll(entry); })) entry->running = false;
+    }
+}
+
+void OPCPollScheduler::poll(std::shared_ptr<polledGroup> entry) {
+    auto start = std::chrono::steady_clock::now();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (entry->removed) {
+            entry->running = false;
+            idleCv.notify_all();
+            return;
+        }
+        if (entry->lastStart != std::chrono::steady_clock::time_point()) {
+            double period = std::chrono::duration<double, std::milli>(start - entry->lastStart).count();
+            entry->stats.averagePeriodMs = (entry->stats.averagePeriodMs == 0) ? period : 0.8 * entry->stats.averagePeriodMs + 0.2 * period;
+            entry->stats.maxPeriodMs = std::max(entry->stats.maxPeriodMs, period);
+        }
+        entry->lastStart = start;
+    }
+
+    entry->group->syncReadGroup();
+
+    double read = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        entry->stats.polls++;
+        entry->stats.averageReadMs = (entry->stats.averageReadMs == 0) ? read : 0.8 * entry->stats.averageReadMs + 0.2 * read;
+        entry->running = false;
+    }
+    idleCv.notify_all();
+}
@@ -0,0 +1,286 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcredundantpair.h"
+
+#include <iterator>
+
+
+static const char *serverName(size_t server) {
+    return server == 0 ? "primary" : "secondary";
+}
+
+static uint64_t fileTimeToUInt64(const FILETIME &time) {
+    return (static_cast<uint64_t>(time.dwHighDateTime) << 32) | time.dwLowDateTime;
+}
+
+OPCRedundantPair::OPCRedundantPair(easyopcda::ASyncCallback func) {
+    mCallbackFunc = std::move(func);
+    activeServer = 0;
+    stats = {0, 0, 0, 0, 0, 0};
+    skewTolerance = 0;
+    monitorRunning = false;
+    checkPeriodMs = 1000;
+    failoverRequested = false;
+    failureTime = std::chrono::steady_clock::now();
+    draining = false;
+
+    for (size_t server = 0; server < 2; server++) {
+        clients[server] = new OPCClient([this, server](std::wstring groupName, easyopcda::opcTagResult result) {
+            deliver(server, groupName, result);
+        });
+        clients[server]->setConnectionLostCallback([this, server](const std::string &cause) { connectionLost(server, cause); });
+    }
+}
+
+OPCRedundantPair::~OPCRedundantPair() {
+    stopMonitor();
+    delete clients[0];
+    delete clients[1];
+}
+
+OPCClient *OPCRedundantPair::getClient(size_t server) {
+    if (server > 1) {
+        ERROR_LOG("Invalid server index {}", server);
+        return nullptr;
+    }
+    return clients[server];
+}
+
+bool OPCRedundantPair::addGroup(const std::wstring &name, DWORD updateRate, std::vector<std::wstring> &items) {
+    bool created = true;
+    for (size_t server = 0; server < 2; server++) {
+        OPCGroup *group = clients[server]->addGroup(name, updateRate);
+        if (!group) {
+            ERROR_LOG("Group {} could not be created on the {} server", wstringToUTF8(name), serverName(server));
+            created = false;
+            continue;
+        }
+        group->addItems(items);
+        group->asyncEnableAutoReadGroup();
+        if (group->isError()) created = false;
+    }
+    return created;
+}
+
+void OPCRedundantPair::removeGroup(const std::wstring &name) {
+    clients[0]->removeGroup(name);
+    clients[1]->removeGroup(name);
+
+    std::lock_guard<std::mutex> lock(deliveryMutex);
+    for (auto it = tags.begin(); it != tags.end();) {
+        if (it->first.first == name) it = tags.erase(it);
+        else ++it;
+    }
+}
+
+OPCGroup *OPCRedundantPair::getGroup(const std::wstring &name) {
+    return clients[activeServer]->getGroup(name);
+}
+
+void OPCRedundantPair::setSkewTolerance(DWORD skewToleranceMs) {
+    std::lock_guard<std::mutex> lock(deliveryMutex);
+    skewTolerance = static_cast<uint64_t>(skewToleranceMs) * 10000;
+}
+
+// called with deliveryMutex held. timestamps of the same server compare exactly, of the other one with the tolerance
+bool OPCRedundantPair::alreadyDelivered(const tagState &tag, size_t server, uint64_t timestamp) const {
+    uint64_t tolerance = server == tag.lastServer ? 0 : skewTolerance;
+    return timestamp <= tag.lastDelivered + tolerance;
+}
+
+// called from the COM threads of both servers
+void OPCRedundantPair::deliver(size_t server, const std::wstring &groupName, const easyopcda::opcTagResult &result) {
+    uint64_t timestamp = fileTimeToUInt64(result.timestamp);
+
+    std::unique_lock<std::mutex> lock(deliveryMutex);
+    // results without a timestamp (item errors) cannot be matched across servers
+    if (timestamp == 0) {
+        if (server != activeServer) return;
+        outbox.emplace_back(groupName, easyopcda::opcTagValue{result.tagName, result.timestamp, ATL::CComVariant(result.value), result.quality, result.error});
+        drainOutbox(lock);
+        return;
+    }
+
+    tagState &tag = tags[std::make_pair(groupName, result.tagName)];
+    if (alreadyDelivered(tag, server, timestamp)) {
+        stats.duplicatesDropped++;
+        return;
+    }
+    if (server != activeServer) {
+        // kept in timestamp order: a server may report a late value out of order
+        auto at = tag.standby.end();
+        while (at != tag.standby.begin() && fileTimeToUInt64(std::prev(at)->timestamp) > timestamp) --at;
+        tag.standby.insert(at, {result.tagName, result.timestamp, ATL::CComVariant(result.value), result.quality, result.error});
+        if (tag.standby.size() > maxStandbyValues) {
+            tag.standby.pop_front();
+            stats.standbyValuesOverflowed++;
+        }
+        return;
+    }
+
+    tag.lastDelivered = timestamp;
+    tag.lastServer = server;
+    // standby values of the samples the active server delivered
+    while (!tag.standby.empty() && fileTimeToUInt64(tag.standby.front().timestamp) <= timestamp + skewTolerance) tag.standby.pop_front();
+    outbox.emplace_back(groupName, easyopcda::opcTagValue{result.tagName, result.timestamp, ATL::CComVariant(result.value), result.quality, result.error});
+    drainOutbox(lock);
+}
+
+// called with deliveryMutex held. a thread finding the outbox being drained leaves its values to the draining one
+void OPCRedundantPair::drainOutbox(std::unique_lock<std::mutex> &lock) {
+    if (draining) return;
+    draining = true;
+    while (!outbox.empty()) {
+        std::pair<std::wstring, easyopcda::opcTagValue> next = std::move(outbox.front());
+        outbox.pop_front();
+        lock.unlock();
+        easyopcda::opcTagValue &value = next.second;
+        mCallbackFunc(next.first, {value.tagName, value.timestamp, value.value, value.quality, value.error});
+        lock.lock();
+    }
+    draining = false;
+}
+
+// called from COM threads: only wakes the monitor
+void OPCRedundantPair::connectionLost(size_t server, const std::string &cause) {
+    if (server != activeServer) {
+        WARN_LOG("The {} server in standby was lost: {}", serverName(server), cause);
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(monitorMutex);
+    if (!monitorRunning) {
+        WARN_LOG("The active {} server was lost ({}) and the monitor is not running", serverName(server), cause);
+        return;
+    }
+    if (failoverRequested) return;
+    failoverRequested = true;
+    failoverCause = cause;
+    failureTime = std::chrono::steady_clock::now();
+    monitorCv.notify_one();
+}
+
+bool OPCRedundantPair::serverHealthy(size_t server) {
+    OPCSERVERSTATE state;
+    HRESULT hr = clients[server]->getServerState(state);
+    return SUCCEEDED(hr) && state == OPC_STATUS_RUNNING;
+}
+
+void OPCRedundantPair::switchServer(size_t from, const std::string &cause) {
+    std::unique_lock<std::mutex> lock(deliveryMutex);
+    if (activeServer != from) return;
+    size_t to = 1 - from;
+    activeServer = to;
+
+    // values the failed server may not have delivered, in tag order and oldest first within a tag
+    uint64_t replayed = 0;
+    for (auto &it : tags) {
+        tagState &tag = it.second;
+        for (auto &value : tag.standby) {
+            uint64_t timestamp = fileTimeToUInt64(value.timestamp);
+            if (alreadyDelivered(tag, to, timestamp)) continue;
+            tag.lastDelivered = timestamp;
+            tag.lastServer = to;
+            outbox.emplace_back(it.first.first, std::move(value));
+            replayed++;
+        }
+        tag.standby.clear();
+    }
+
+    stats.failovers++;
+    stats.standbyValuesReplayed += replayed;
+    stats.lastSwitchMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - failureTime.load()).count();
+    WARN_LOG("Failover from the {} to the {} server ({}): {} standby values replayed, switched in {:.1f} ms",
+             serverName(from), serverName(to), cause, replayed, stats.lastSwitchMs);
+    // the replayed values are queued before any value of the new active server
+    drainOutbox(lock);
+}
+
+void OPCRedundantPair::failover(const std::string &cause) {
+    failureTime = std::chrono::steady_clock::now();
+    switchServer(activeServer, cause);
+}
+
+void OPCRedundantPair::startMonitor(DWORD checkPeriodMs) {
+    {
+        std::lock_guard<std::mutex> lock(monitorMutex);
+        this->checkPeriodMs = checkPeriodMs ? checkPeriodMs : 1;
+        if (monitorRunning) {
+            monitorCv.notify_one();
+            return;
+        }
+        monitorRunning = true;
+    }
+    monitorThread = std::thread(&OPCRedundantPair::monitor, this);
+}
+
+void OPCRedundantPair::stopMonitor() {
+    {
+        std::lock_guard<std::mutex> lock(monitorMutex);
+        if (!monitorRunning) return;
+        monitorRunning = false;
+    }
+    monitorCv.notify_all();
+    if (monitorThread.joinable()) monitorThread.join();
+}
+
+void OPCRedundantPair::monitor() {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on redundancy monitor thread. Error code = {}", hresultToUTF8(hrInit));
+    }
+
+    std::unique_lock<std::mutex> lock(monitorMutex);
+    while (monitorRunning) {
+        monitorCv.wait_for(lock, std::chrono::milliseconds(checkPeriodMs), [this] { return !monitorRunning || failoverRequested; });
+        if (!monitorRunning) break;
+
+        size_t active = activeServer;
+        std::string cause;
+        if (failoverRequested) {
+            failoverRequested = false;
+            cause = failoverCause;
+        }
+        lock.unlock();
+
+        if (cause.empty() && !serverHealthy(active)) {
+            cause = "server unreachable or not running";
+            failureTime = std::chrono::steady_clock::now();
+        }
+        if (!cause.empty()) {
+            if (serverHealthy(1 - active)) {
+                switchServer(active, cause);
+            } else {
+                ERROR_LOG("The active {} server failed ({}) and the {} server is not available", serverName(active), cause, serverName(1 - active));
+            }
+        }
+
+        lock.lock();
+    }
+    lock.unlock();
+
+    if SUCCEEDED(hrInit) CoUninitialize();
+}
+
+easyopcda::opcFailoverStats OPCRedundantPair::getFailoverStats() {
+    std::lock_guard<std::mutex> lock(deliveryMutex);
+    easyopcda::opcFailoverStats current = stats;
+    current.activeServer = activeServer;
+    return current;
+}
@@ -0,0 +1,178 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcservermanager.h"
+
+#include <algorithm>
+
+
+OPCServerManager::OPCServerManager(easyopcda::ManagedCallback func, const easyopcda::opcManagerLimits &limits)
+    : mCallbackFunc(std::move(func)), limits(limits), pool("servers", std::max<size_t>(1, limits.maxThreads)) {
+    if (this->limits.threadsPerServer == 0) this->limits.threadsPerServer = 1;
+    stats = {0, 0, 0, 0, 0};
+    deliveryRunning = true;
+    deliveryThread = std::thread(&OPCServerManager::deliver, this);
+}
+
+OPCServerManager::~OPCServerManager() {
+    for (auto &name : getServerNames()) removeServer(name);
+    pool.shutdown();
+
+    {
+        std::lock_guard<std::mutex> lock(deliveryMutex);
+        deliveryRunning = false;
+    }
+    deliveryCv.notify_all();
+    if (deliveryThread.joinable()) deliveryThread.join();
+}
+
+OPCClient *OPCServerManager::addServer(const std::wstring &name) {
+    std::lock_guard<std::mutex> lock(serversMutex);
+    if (servers.count(name) > 0) {
+        WARN_LOG("Server {} already exists. Skipping...", wstringToUTF8(name));
+        return nullptr;
+    }
+    auto lane = std::make_shared<serverLane>();
+    // the client runs its own asynchronous calls on a lane of the shared pool
+    lane->executor.reset(new OPCExecutor("server " + wstringToUTF8(name), pool, limits.threadsPerServer));
+    lane->client = new OPCClient([this, name](std::wstring groupName, easyopcda::opcTagResult result) {
+        enqueue(name, groupName, result);
+    }, lane->executor.get());
+    // bulk work on the server stays within its lane as well
+    lane->client->setBulkThreads(0);
+    servers[name] = lane;
+    INFO_LOG("Server {} added", wstringToUTF8(name));
+    return lane->client;
+}
+
+void OPCServerManager::removeServer(const std::wstring &name) {
+    std::shared_ptr<serverLane> lane;
+    {
+        std::unique_lock<std::mutex> lock(serversMutex);
+        auto it = servers.find(name);
+        if (it == servers.end()) {
+            ERROR_LOG("Invalid server name");
+            return;
+        }
+        lane = it->second;
+        servers.erase(it);
+        lane->removing = true;
+        lane->tasks.clear();
+        laneIdleCv.wait(lock, [&lane] { return lane->running == 0; });
+    }
+
+    lane->executor->drain();
+    delete lane->client;
+    lane->executor.reset();
+    INFO_LOG("Server {} removed", wstringToUTF8(name));
+}
+
+OPCClient *OPCServerManager::getServer(const std::wstring &name) {
+    std::lock_guard<std::mutex> lock(serversMutex);
+    auto it = servers.find(name);
+    if (it == servers.end()) {
+        ERROR_LOG("Invalid server name");
+        return nullptr;
+    }
+    return it->second->client;
+}
+
+std::vector<std::wstring> OPCServerManager::getServerNames() {
+    std::lock_guard<std::mutex> lock(serversMutex);
+    std::vector<std::wstring> names;
+    for (auto &it : servers) names.push_back(it.first);
+    return names;
+}
+
+bool OPCServerManager::schedule(const std::wstring &name, std::function<void(OPCClient *)> task) {
+    std::lock_guard<std::mutex> lock(serversMutex);
+    auto it = servers.find(name);
+    if (it == servers.end()) {
+        ERROR_LOG("Invalid server name");
+        return false;
+    }
+    std::shared_ptr<serverLane> lane = it->second;
+    lane->tasks.push_back(std::move(task));
+    if (lane->running < limits.threadsPerServer) {
+        lane->running++;
+        if (!pool.post([this, lane] { runLane(lane); })) lane->running--;
+    }
+    return true;
+}
+
+// runs one task of the lane, then queues the lane again behind the other servers
+void OPCServerManager::runLane(std::shared_ptr<serverLane> lane) {
+    std::function<void(OPCClient *)> task;
+    {
+        std::lock_guard<std::mutex> lock(serversMutex);
+        if (!lane->tasks.empty()) {
+            task = std::move(lane->tasks.front());
+            lane->tasks.pop_front();
+        }
+    }
+    if (task) task(lane->client);
+
+    std::lock_guard<std::mutex> lock(serversMutex);
+    if (lane->tasks.empty() || !pool.post([this, lane] { runLane(lane); })) {
+        lane->running--;
+        laneIdleCv.notify_all();
+    }
+}
+
+// called from the COM threads of every server: the value is copied and queued, never delivered here
+void OPCServerManager::enqueue(const std::wstring &server, const std::wstring &group, const easyopcda::opcTagResult &result) {
+    {
+        std::lock_guard<std::mutex> lock(deliveryMutex);
+        if (limits.maxQueuedValues > 0 && queued.size() >= limits.maxQueuedValues) {
+            stats.valuesDropped++;
+            return;
+        }
+        queued.push_back({server, group, {result.tagName, result.timestamp, ATL::CComVariant(result.value), result.quality, result.error}});
+        stats.maxValuesQueued = std::max(stats.maxValuesQueued, queued.size());
+    }
+    deliveryCv.notify_one();
+}
+
+void OPCServerManager::deliver() {
+    std::deque<managedValue> batch;
+    std::unique_lock<std::mutex> lock(deliveryMutex);
+    for (;;) {
+        deliveryCv.wait(lock, [this] { return !deliveryRunning || !queued.empty(); });
+        if (queued.empty()) break;
+
+        batch.swap(queued);
+        lock.unlock();
+        for (auto &item : batch) mCallbackFunc(item.server, item.group, item.value);
+        lock.lock();
+        stats.valuesDelivered += batch.size();
+        batch.clear();
+    }
+}
+
+easyopcda::opcManagerStats OPCServerManager::getStats() {
+    size_t serverCount;
+    {
+        std::lock_guard<std::mutex> lock(serversMutex);
+        serverCount = servers.size();
+    }
+    std::lock_guard<std::mutex> lock(deliveryMutex);
+    easyopcda::opcManagerStats current = stats;
+    current.servers = serverCount;
+    current.valuesQueued = queued.size();
+    return current;
+}
@@ -0,0 +1,117 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opcstealingexecutor.h"
+
+#include <utility>
+
+// worker of the executor running on this thread, if any
+static thread_local const OPCStealingExecutor *currentExecutor = nullptr;
+static thread_local size_t currentWorker = 0;
+
+
+OPCStealingExecutor::OPCStealingExecutor(std::string name, size_t threads) : name(std::move(name)), nextWorker(0), steals(0) {
+    pending = 0;
+    running = true;
+    if (threads == 0) threads = 1;
+    for (size_t i = 0; i < threads; i++) workers.emplace_back(new worker());
+    for (size_t i = 0; i < threads; i++) workers[i]->thread = std::thread(&OPCStealingExecutor::run, this, i);
+    DEBUG_LOG("Executor {} started {} threads", this->name, threads);
+}
+
+OPCStealingExecutor::~OPCStealingExecutor() {
+    shutdown();
+}
+
+bool OPCStealingExecutor::post(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        if (!running) return false;
+        pending++;
+    }
+
+    size_t index = (currentExecutor == this) ? currentWorker : nextWorker++ % workers.size();
+    {
+        std::lock_guard<std::mutex> lock(workers[index]->mutex);
+        workers[index]->tasks.push_back(std::move(task));
+    }
+    idleCv.notify_one();
+    return true;
+}
+
+void OPCStealingExecutor::shutdown() {
+    {
+        std::lock_guard<std::mutex> lock(idleMutex);
+        if (!running && workers.empty()) return;
+        running = false;
+    }
+    idleCv.notify_all();
+    for (auto &w : workers) {
+        if (w->thread.joinable()) w->thread.join();
+    }
+    workers.clear();
+}
+
+// the front of the own queue, else the back of another one
+bool OPCStealingExecutor::take(size_t index, std::function<void()> &task) {
+    for (size_t k = 0; k < workers.size(); k++) {
+        worker &victim = *workers[(index + k) % workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        } else {
+            task = std::move(victim.tasks.back());
+            victim.tasks.pop_back();
+            steals++;
+        }
+        std::lock_guard<std::mutex> idleLock(idleMutex);
+        pending--;
+        return true;
+    }
+    return false;
+}
+
+void OPCStealingExecutor::run(size_t index) {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on executor {} thread {}. Error code = {}", name, index, hresultToUTF8(hrInit));
+    }
+    currentExecutor = this;
+    currentWorker = index;
+
+    auto tid = std::this_thread::get_id();
+    auto hid = std::hash<std::thread::id>{}(tid);
+    DEBUG_LOG("Thread {} running executor {}", hid, name);
+
+    for (;;) {
+        std::function<void()> task;
+        if (take(index, task)) {
+            task();
+            continue;
+        }
+        // a task counted in pending may not be in a queue yet: the worker then looks again
+        std::unique_lock<std::mutex> lock(idleMutex);
+        idleCv.wait(lock, [this] { return !running || pending > 0; });
+        if (!running && pending == 0) break;
+    }
+
+    currentExecutor = nullptr;
+    if SUCCEEDED(hrInit) CoUninitialize();
+}
@@ -0,0 +1,118 @@
+// ******  easyopcda v0.2  ******
+// Copyright (C) 2024 Carlo Seghi. All rights reserved.
+// Author Carlo Seghi github.com/acs48.
+//
+// This library is free software; you can redistribute it and/or
+// modify it under the terms of the GNU Library General Public
+// License as published by the Free Software Foundation v3.0
+//
+// This library is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the GNU
+// Library General Public License for more details.
+//
+// Use of this source code is governed by a GNU General Public License v3.0
+// License that can be found in the LICENSE file.
+
+#include "easyopcda/easyopcda.h"
+#include "easyopcda/opctimer.h"
+
+#include <algorithm>
+#include <utility>
+
+
+OPCTimer::OPCTimer(std::string name) : name(std::move(name)) {
+    nextSequence = 1;
+    running = true;
+    timerThread = std::thread(&OPCTimer::timer, this);
+}
+
+OPCTimer::~OPCTimer() {
+    shutdown();
+}
+
+uint64_t OPCTimer::schedule(std::chrono::steady_clock::time_point time, std::function<void()> func) {
+    uint64_t id;
+    bool earliest;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!running) return 0;
+        id = nextSequence++;
+        earliest = due.empty() || time < due.front().time;
+        due.push_back({time, id});
+        std::push_heap(due.begin(), due.end(), timerEntryLater());
+        functions[id] = std::move(func);
+    }
+    if (earliest) cv.notify_one();
+    return id;
+}
+
+void OPCTimer::cancel(uint64_t id) {
+    std::function<void()> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = functions.find(id);
+        if (it == functions.end()) return;
+        dropped = std::move(it->second);
+        functions.erase(it);
+        // entries of cancelled functions are kept at most as many as the live ones
+        if (due.size() > 2 * functions.size() + 64) {
+            due.erase(std::remove_if(due.begin(), due.end(), [this](const timerEntry &entry) {
+                return functions.count(entry.sequence) == 0;
+            }), due.end());
+            std::make_heap(due.begin(), due.end(), timerEntryLater());
+        }
+    }
+    // the function may hold references whose release runs code of its own: not under the lock
+    dropped = nullptr;
+}
+
+void OPCTimer::shutdown() {
+    std::unordered_map<uint64_t, std::function<void()>> dropped;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        running = false;
+    }
+    cv.notify_all();
+    if (timerThread.joinable()) timerThread.join();
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        dropped.swap(functions);
+        due.clear();
+    }
+    // the functions may hold references whose release runs code of their own: not under the lock
+    dropped.clear();
+}
+
+void OPCTimer::timer() {
+    HRESULT hrInit = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if FAILED(hrInit) {
+        ERROR_LOG("Failed to initialize COM on timer {} thread. Error code = {}", name, hresultToUTF8(hrInit));
+    }
+
+    std::unique_lock<std::mutex> lock(mutex);
+    while (running) {
+        if (due.empty()) {
+            cv.wait(lock);
+            continue;
+        }
+        if (std::chrono::steady_clock::now() < due.front().time) {
+            cv.wait_until(lock, due.front().time);
+            continue;
+        }
+        std::pop_heap(due.begin(), due.end(), timerEntryLater());
+        uint64_t id = due.back().sequence;
+        due.pop_back();
+        auto it = functions.find(id);
+        if (it == functions.end()) continue; // cancelled
+        std::function<void()> func = std::move(it->second);
+        functions.erase(it);
+        lock.unlock();
+        func();
+        func = nullptr;
+        lock.lock();
+    }
+    lock.unlock();
+
+    if SUCCEEDED(hrInit) CoUninitialize();
+}